@@ -2,12 +2,18 @@
  Copyright (c) 2012-2015 Nion Company.
 */
 
+#include <atomic>
 #include <stdint.h>
 
 #include "Application.h"
+#include "CanvasTrace.h"
 #include "DocumentWindow.h"
 #include "PythonSupport.h"
+#include "PythonStubs.h"
 #include "FileSystem.h"
+#include "ImageKernels.h"
+#include "TaskRunner.h"
+#include "Telemetry.h"
 
 #include <QtCore/QDebug>
 #include <QtCore/QDir>
@@ -17,9 +23,11 @@
 #include <QtCore/QMimeData>
 #include <QtCore/QProcessEnvironment>
 #include <QtCore/QRegularExpression>
+#include <QtCore/QSemaphore>
 #include <QtCore/QSettings>
 #include <QtCore/QStandardPaths>
 #include <QtCore/QThread>
+#include <QtCore/QThreadPool>
 #include <QtCore/QTimer>
 
 #include <QtGui/QClipboard>
@@ -241,20 +249,211 @@ QVariant PythonValueVariantToQVariant(const PythonValueVariant &value_variant)
     return QVariant();
 }
 
-QVariant PyObjectToQVariant(PyObject *py_object)
+// returns false and clears the error if the string cannot be encoded as UTF-8 (it has lone surrogates).
+static bool PyUnicodeToQString(PyObject *py_string, QString &string)
 {
-    return PythonValueVariantToQVariant(PyObjectToValueVariant(py_object));
+    const char *utf8 = CALL_PY(PyUnicode_AsUTF8)(py_string);
+    if (!utf8)
+    {
+        CALL_PY(PyErr_Clear)();
+        return false;
+    }
+    string = QString::fromUtf8(utf8);
+    return true;
 }
 
-inline PyObject *WrapQObject(QObject *ptr)
+static PyObject *QStringToPyUnicode(const QString &string)
 {
-    return PythonValueVariantToPyObject(QVariantToPythonValueVariant(QVariant::fromValue(static_cast<QObject *>(ptr))));
+    return CALL_PY(PyUnicode_FromString)(string.toUtf8().constData());
+}
+
+// PyObjectToQVariant and QVariantToPyObject convert in a single pass, without building a PythonValueVariant.
+// the results are the same as converting through one, except that a QObject capsule converts to its QObject
+// rather than to a null QObject, which the conversion through a PythonValueVariant gave since it unwrapped the
+// pointer of the capsule again. strings that cannot be encoded as UTF-8 convert to an invalid QVariant and dict
+// entries whose keys are not such strings are dropped. both must be called with the GIL.
+
+QVariant PyObjectToQVariant(PyObject *py_object)
+{
+    if (PyUnicode_Check(py_object))
+    {
+        QString string;
+        return PyUnicodeToQString(py_object, string) ? QVariant(string) : QVariant();
+    }
+    else if (PyLong_Check(py_object))
+    {
+        // includes bool, which is a subclass of int.
+        return QVariant(static_cast<int>(PyInt_AsLong(py_object)));
+    }
+    else if (CALL_PY(PyFloat_Check)(py_object))
+    {
+        return QVariant(CALL_PY(PyFloat_AsDouble)(py_object));
+    }
+    else if (CALL_PY(PyCapsule_IsValid)(py_object, PythonSupport::qobject_capsule_name) && CALL_PY(PyCapsule_CheckExact)(py_object))
+    {
+        return QVariant::fromValue(static_cast<QObject *>(CALL_PY(PyCapsule_GetPointer)(py_object, PythonSupport::qobject_capsule_name)));
+    }
+    else if (PyDict_Check(py_object))
+    {
+        QVariantMap map;
+        Py_ssize_t pos = 0;
+        PyObject *key = nullptr;  // borrowed
+        PyObject *value = nullptr;  // borrowed
+        while (CALL_PY(PyDict_Next)(py_object, &pos, &key, &value))
+        {
+            QString key_string;
+            if (PyUnicode_Check(key) && PyUnicodeToQString(key, key_string))
+                map.insert(key_string, PyObjectToQVariant(value));
+        }
+        return map;
+    }
+    else if (PyList_Check(py_object) || PyTuple_Check(py_object))
+    {
+        const Py_ssize_t count = PySequence_Fast_GET_SIZE(py_object);
+        PyObject **items = PySequence_Fast_ITEMS(py_object);
+        QVariantList list;
+        list.reserve(count);
+        for (Py_ssize_t i = 0; i < count; ++i)
+            list.append(PyObjectToQVariant(items[i]));
+        return list;
+    }
+    else if (py_object == CALL_PY(Py_NoneGet)())
+    {
+        return QVariant();
+    }
+    else
+    {
+        PyObjectPtr py_object_ptr;
+        py_object_ptr.setPyObject(py_object);
+        return QVariant::fromValue(py_object_ptr);
+    }
 }
 
 // New reference
 PyObject *QVariantToPyObject(const QVariant &value)
 {
-    return PythonValueVariantToPyObject(QVariantToPythonValueVariant(value));
+    const void *data = value.constData();
+    int type = value.userType();
+
+    switch (type)
+    {
+        case QMetaType::Char:
+            return CALL_PY(PyLong_FromLong)(static_cast<long>(*((const char*)data)));
+
+        case QMetaType::UChar:
+            return CALL_PY(PyLong_FromLong)(static_cast<long>(*((const unsigned char*)data)));
+
+        case QMetaType::Short:
+            return CALL_PY(PyLong_FromLong)(static_cast<long>(*((const short*)data)));
+
+        case QMetaType::UShort:
+            return CALL_PY(PyLong_FromLong)(static_cast<long>(*((const unsigned short*)data)));
+
+        case QMetaType::Long:
+            return CALL_PY(PyLong_FromLong)(*((const long*)data));
+
+        case QMetaType::ULong:
+            // does not fit into simple int of python
+            return CALL_PY(PyLong_FromLongLong)(static_cast<long long>(*((const unsigned long*)data)));
+
+        case QMetaType::Bool:
+        {
+            PyObject *py_bool = value.toBool() ? CALL_PY(Py_TrueGet)() : CALL_PY(Py_FalseGet)();
+            Py_INCREF(py_bool);
+            return py_bool;
+        }
+
+        case QMetaType::Int:
+            return CALL_PY(PyLong_FromLong)(static_cast<long>(*((const int*)data)));
+
+        case QMetaType::UInt:
+            // does not fit into simple int of python
+            return CALL_PY(PyLong_FromLongLong)(static_cast<long long>(*((const unsigned int*)data)));
+
+        case QMetaType::QChar:
+            return CALL_PY(PyLong_FromLong)(static_cast<long>(*((const short*)data)));
+
+        case QMetaType::Float:
+            return CALL_PY(PyFloat_FromDouble)(static_cast<double>(*((const float*)data)));
+
+        case QMetaType::Double:
+            return CALL_PY(PyFloat_FromDouble)(*((const double*)data));
+
+        case QMetaType::LongLong:
+        case QMetaType::ULongLong:
+            return CALL_PY(PyLong_FromLongLong)(static_cast<long long>(*((const qint64*)data)));
+
+        case QMetaType::QUrl:
+            return QStringToPyUnicode(value.toUrl().toString());
+
+        case QMetaType::QVariantMap:
+        {
+            const QVariantMap &map = *static_cast<const QVariantMap *>(data);
+            PyObject *py_map = CALL_PY(PyDict_New)();
+            for (auto iter = map.constBegin(); iter != map.constEnd(); ++iter)
+            {
+                PyObject *py_key = QStringToPyUnicode(iter.key());
+                PyObject *py_value = QVariantToPyObject(iter.value());
+                CALL_PY(PyDict_SetItem)(py_map, py_key, py_value);
+                Py_DECREF(py_key);
+                Py_DECREF(py_value);
+            }
+            return py_map;
+        }
+
+        case QMetaType::QVariantList:
+        {
+            const QVariantList &list = *static_cast<const QVariantList *>(data);
+            PyObject *py_list = CALL_PY(PyTuple_New)(list.size());
+            for (Py_ssize_t i = 0; i < list.size(); ++i)
+                PyTuple_SET_ITEM(py_list, i, QVariantToPyObject(list[i]));  // steals reference
+            return py_list;
+        }
+
+        case QMetaType::QString:
+            return QStringToPyUnicode(*static_cast<const QString *>(data));
+
+        case QMetaType::QStringList:
+        {
+            const QStringList &list = *static_cast<const QStringList *>(data);
+            PyObject *py_list = CALL_PY(PyTuple_New)(list.size());
+            for (Py_ssize_t i = 0; i < list.size(); ++i)
+                PyTuple_SET_ITEM(py_list, i, QStringToPyUnicode(list[i]));  // steals reference
+            return py_list;
+        }
+
+        case QMetaType::QObjectStar:
+            return CALL_PY(PyCapsule_New)(*static_cast<QObject * const *>(data), PythonSupport::qobject_capsule_name, NULL);
+
+        default:
+        {
+            if (type == PyObjectPtr_metaId())
+            {
+                PyObject *py_object = static_cast<const PyObjectPtr *>(data)->get();
+                if (py_object)
+                {
+                    Py_INCREF(py_object);
+                    return py_object;
+                }
+            }
+            else if (type == qMetaTypeId<QList<QUrl>>())
+            {
+                const QList<QUrl> &list = *static_cast<const QList<QUrl> *>(data);
+                PyObject *py_list = CALL_PY(PyTuple_New)(list.size());
+                for (Py_ssize_t i = 0; i < list.size(); ++i)
+                    PyTuple_SET_ITEM(py_list, i, QStringToPyUnicode(list[i].toString()));  // steals reference
+                return py_list;
+            }
+        }
+    }
+
+    Py_INCREF(CALL_PY(Py_NoneGet)());
+    return CALL_PY(Py_NoneGet)();
+}
+
+inline PyObject *WrapQObject(QObject *ptr)
+{
+    return QVariantToPyObject(QVariant::fromValue(static_cast<QObject *>(ptr)));
 }
 
 QString lastVisitedDir;
@@ -939,33 +1138,94 @@ static PyObject *Canvas_draw(PyObject * /*self*/, PyObject *args)
     return PythonSupport::instance()->getNoneReturnValue();
 }
 
+// records the drawing commands submitted to canvases when open. see NIONUI_CANVAS_TRACE and Core_setCanvasTraceFile.
+static CanvasTraceWriter canvas_trace_writer;
+
+static void TraceCanvasCommands(int section_id, const DrawingCommandsSharedPtr &drawing_commands, float display_scaling, float device_pixel_ratio)
+{
+    if (canvas_trace_writer.isOpen())
+    {
+        CanvasTraceFrame frame;
+        frame.section_id = section_id;
+        frame.rect = drawing_commands->rect();
+        frame.display_scaling = display_scaling;
+        frame.device_pixel_ratio = device_pixel_ratio;
+        frame.commands = drawing_commands->commands();
+        frame.image_buffers = drawing_commands->imageBuffers();
+        canvas_trace_writer.write(frame);
+    }
+}
+
+// pin the arrays of an image map (a dict of image id to array) so that the drawing commands
+// referencing them can be rendered without the GIL. must be called with the GIL held.
+static ImageBufferMap PinImageBuffers(PyObject *image_map_py)
+{
+    ImageBufferMap image_buffers;
+    QMap<QString, QVariant> image_map = PyObjectToQVariant(image_map_py).toMap();
+    for (auto iter = image_map.constBegin(); iter != image_map.constEnd(); ++iter)
+    {
+        PyObjectPtr ndarray_py(QVariantToPyObject(iter.value()));
+        if (ndarray_py)
+            image_buffers[iter.key().toInt()] = PythonSupport::instance()->pinArray(ndarray_py);
+    }
+    return image_buffers;
+}
+
+// the drawing commands in a binary command buffer obtained with the GIL. by default the commands are copied
+// and the buffer is released. if keep_buffer is set, the commands reference the buffer directly and it is
+// released when the commands are destroyed; the caller must not modify the buffer after submitting it.
+static CommandsSharedPtr TakeCommandBuffer(Py_buffer &buffer, bool keep_buffer)
+{
+    CommandsSharedPtr command_buffer;
+
+    if (keep_buffer)
+    {
+        command_buffer.reset(new CommandBuffer((const quint32 *)buffer.buf, buffer.len / 4, PythonSupport::instance()->bufferOwner(buffer)));
+    }
+    else
+    {
+        {
+            Python_ThreadAllow thread_allow;
+            command_buffer.reset(new CommandBuffer((const quint32 *)buffer.buf, buffer.len / 4));
+        }
+
+        PythonSupport::instance()->bufferRelease(&buffer);
+    }
+
+    return command_buffer;
+}
+
 static PyObject *Canvas_draw_binary(PyObject * /*self*/, PyObject *args)
 {
     PyObject *obj0 = NULL;
     Py_buffer buffer;
     PyObject *obj1 = NULL;
+    int keep_buffer = 0;
 
-    if (!PythonSupport::instance()->parse()(args, "Ow*O", &obj0, &buffer, &obj1))
+    if (!PythonSupport::instance()->parse()(args, "Ow*O|p", &obj0, &buffer, &obj1, &keep_buffer))
         return NULL;
 
     PyCanvas *canvas = Unwrap<PyCanvas>(obj0);
     if (canvas == NULL)
+    {
+        PythonSupport::instance()->bufferRelease(&buffer);
         return NULL;
+    }
 
-    QMap<QString, QVariant> imageMap = PyObjectToQVariant(obj1).toMap();
+    ImageBufferMap image_buffers = PinImageBuffers(obj1);
+
+    CommandsSharedPtr command_buffer = TakeCommandBuffer(buffer, keep_buffer);
 
     {
         Python_ThreadAllow thread_allow;
 
-        CommandsSharedPtr command_buffer(new std::vector<quint32>((quint32 *)buffer.buf, ((quint32 *)buffer.buf) + buffer.len / 4));
+        DrawingCommandsSharedPtr drawing_commands(new DrawingCommands(command_buffer, canvas->rect(), image_buffers));
 
-        DrawingCommandsSharedPtr drawing_commands(new DrawingCommands(command_buffer, canvas->rect(), imageMap));
+        TraceCanvasCommands(0, drawing_commands, GetDisplayScaling(), canvas->devicePixelRatioF());
 
         canvas->setBinarySectionCommands(0, drawing_commands);
     }
 
-    PythonSupport::instance()->bufferRelease(&buffer);
-
     return PythonSupport::instance()->getNoneReturnValue();
 }
 
@@ -979,30 +1239,42 @@ static PyObject *Canvas_drawSection_binary(PyObject * /*self*/, PyObject *args)
     int top = 0;
     int width = 0;
     int height = 0;
+    int keep_buffer = 0;
+    int dirty_left = 0;
+    int dirty_top = 0;
+    int dirty_width = 0;
+    int dirty_height = 0;
 
-    if (!PythonSupport::instance()->parse()(args, "Oiw*Oiiii", &obj0, &section_id, &buffer, &obj1, &left, &top, &width, &height))
+    // the optional dirty rect is relative to the section. if it is empty, the whole section is repainted.
+    if (!PythonSupport::instance()->parse()(args, "Oiw*Oiiii|piiii", &obj0, &section_id, &buffer, &obj1, &left, &top, &width, &height, &keep_buffer, &dirty_left, &dirty_top, &dirty_width, &dirty_height))
         return NULL;
 
     PyCanvas *canvas = Unwrap<PyCanvas>(obj0);
     if (canvas == NULL)
+    {
+        PythonSupport::instance()->bufferRelease(&buffer);
         return NULL;
+    }
 
-    QMap<QString, QVariant> imageMap = PyObjectToQVariant(obj1).toMap();
+    ImageBufferMap image_buffers = PinImageBuffers(obj1);
 
     float display_scaling = GetDisplayScaling();
 
+    // scale the dirty rect outwards so that it covers all the pixels that changed.
+    QRect dirty_rect = QRectF(dirty_left * display_scaling, dirty_top * display_scaling, dirty_width * display_scaling, dirty_height * display_scaling).toAlignedRect();
+
+    CommandsSharedPtr command_buffer = TakeCommandBuffer(buffer, keep_buffer);
+
     {
         Python_ThreadAllow thread_allow;
 
-        CommandsSharedPtr command_buffer(new std::vector<quint32>((quint32 *)buffer.buf, ((quint32 *)buffer.buf) + buffer.len / 4));
+        DrawingCommandsSharedPtr drawing_commands(new DrawingCommands(command_buffer, QRect(QPoint(left * display_scaling, top * display_scaling), QSize(width * display_scaling, height * display_scaling)), image_buffers, dirty_rect));
 
-        DrawingCommandsSharedPtr drawing_commands(new DrawingCommands(command_buffer, QRect(QPoint(left * display_scaling, top * display_scaling), QSize(width * display_scaling, height * display_scaling)), imageMap));
+        TraceCanvasCommands(section_id, drawing_commands, display_scaling, canvas->devicePixelRatioF());
 
         canvas->setBinarySectionCommands(section_id, drawing_commands);
     }
 
-    PythonSupport::instance()->bufferRelease(&buffer);
-
     return PythonSupport::instance()->getNoneReturnValue();
 }
 
@@ -1564,6 +1836,54 @@ QFont ParseFontString(const QString &font_string, float display_scaling = 1.0)
     return font;
 }
 
+static PyObject *Core_getCanvasBackBufferStats(PyObject * /*self*/, PyObject *args)
+{
+    Q_UNUSED(args)
+
+    const BackBufferStats stats = CanvasBackBufferStats();
+
+    QVariantMap result;
+    result["hits"] = stats.hits;
+    result["misses"] = stats.misses;
+
+    return QVariantToPyObject(result);
+}
+
+// the canvas command profiles as a list of dicts with section_id, command, count and elapsed_ns. see Core_setCanvasProfilingEnabled.
+static PyObject *Core_getCanvasProfile(PyObject * /*self*/, PyObject *args)
+{
+    Q_UNUSED(args)
+
+    QVariantList result;
+
+    const QMap<int, CommandProfile> profiles = CanvasProfiles();
+    for (auto section_iter = profiles.constBegin(); section_iter != profiles.constEnd(); ++section_iter)
+    {
+        for (auto iter = section_iter.value().constBegin(); iter != section_iter.value().constEnd(); ++iter)
+        {
+            QVariantMap timing;
+            timing["section_id"] = section_iter.key();
+            timing["command"] = CommandName(iter.key());
+            timing["count"] = iter.value().count;
+            timing["elapsed_ns"] = qint64(iter.value().elapsed_ns);
+            result.append(timing);
+        }
+    }
+
+    return QVariantToPyObject(result);
+}
+
+// write the telemetry summary to the log.
+static PyObject *Core_dumpTelemetry(PyObject * /*self*/, PyObject *args)
+{
+    Q_UNUSED(args)
+
+    for (const auto &line : Telemetry::summary())
+        qDebug().noquote() << line;
+
+    return PythonSupport::instance()->getNoneReturnValue();
+}
+
 static PyObject *Core_getFontMetrics(PyObject * /*self*/, PyObject *args)
 {
     char *font_c = NULL;
@@ -1691,6 +2011,49 @@ static PyObject *Core_pathToURL(PyObject * /*self*/, PyObject *args)
     return PythonSupport::instance()->build()("s", url_string.toUtf8().data());
 }
 
+// the telemetry histograms as a list of dicts with name, count and the sum, min, max, mean, p50, p90 and p99 in nanoseconds.
+static PyObject *Core_getTelemetry(PyObject * /*self*/, PyObject *args)
+{
+    Q_UNUSED(args)
+
+    QVariantList result;
+
+    for (const auto &snapshot : Telemetry::snapshots())
+    {
+        QVariantMap histogram;
+        histogram["name"] = snapshot.name;
+        histogram["count"] = qint64(snapshot.count);
+        histogram["sum_ns"] = qint64(snapshot.sum);
+        histogram["min_ns"] = qint64(snapshot.minimum);
+        histogram["max_ns"] = qint64(snapshot.maximum);
+        histogram["mean_ns"] = snapshot.mean();
+        histogram["p50_ns"] = qint64(snapshot.percentile(50));
+        histogram["p90_ns"] = qint64(snapshot.percentile(90));
+        histogram["p99_ns"] = qint64(snapshot.percentile(99));
+        result.append(histogram);
+    }
+
+    return QVariantToPyObject(result);
+}
+
+static PyObject *Core_resetCanvasProfile(PyObject * /*self*/, PyObject *args)
+{
+    Q_UNUSED(args)
+
+    ResetCanvasProfiles();
+
+    return PythonSupport::instance()->getNoneReturnValue();
+}
+
+static PyObject *Core_resetTelemetry(PyObject * /*self*/, PyObject *args)
+{
+    Q_UNUSED(args)
+
+    Telemetry::reset();
+
+    return PythonSupport::instance()->getNoneReturnValue();
+}
+
 static PyObject *Core_setApplicationInfo(PyObject * /*self*/, PyObject *args)
 {
     PyObject *application_name_u = NULL;
@@ -1706,6 +2069,51 @@ static PyObject *Core_setApplicationInfo(PyObject * /*self*/, PyObject *args)
     return PythonSupport::instance()->getNoneReturnValue();
 }
 
+static PyObject *Core_setCanvasProfilingEnabled(PyObject * /*self*/, PyObject *args)
+{
+    int enabled = 0;
+    if (!PythonSupport::instance()->parse()(args, "p", &enabled))
+        return NULL;
+
+    SetCanvasProfilingEnabled(enabled);
+
+    return PythonSupport::instance()->getNoneReturnValue();
+}
+
+static PyObject *Core_setCanvasTraceFile(PyObject * /*self*/, PyObject *args)
+{
+    char *file_path_c = NULL;
+    if (!PythonSupport::instance()->parse()(args, "s", &file_path_c))
+        return NULL;
+
+    // an empty path stops recording.
+    QString file_path = QString::fromUtf8(file_path_c);
+
+    bool success = true;
+
+    {
+        Python_ThreadAllow thread_allow;
+
+        if (file_path.isEmpty())
+            canvas_trace_writer.close();
+        else
+            success = canvas_trace_writer.open(file_path);
+    }
+
+    return QVariantToPyObject(success);
+}
+
+static PyObject *Core_setImageRenderThreadCount(PyObject * /*self*/, PyObject *args)
+{
+    int thread_count = 0;
+    if (!PythonSupport::instance()->parse()(args, "i", &thread_count))
+        return NULL;
+
+    ImageKernels::setThreadCount(thread_count);
+
+    return PythonSupport::instance()->getNoneReturnValue();
+}
+
 QElapsedTimer timer;
 qint64 timer_offset_ns = 0;
 
@@ -2695,14 +3103,15 @@ static PyObject *Drag_setThumbnail(PyObject * /*self*/, PyObject *args)
 
     if (!PythonSupport::instance()->isNone(obj1))
     {
+        float display_scaling = GetDisplayScaling();
+
+        // the thumbnail is shown at its pixel size; average large images down to the thumbnail size.
         QImageInterface image;
-        PythonSupport::instance()->imageFromRGBA(obj1, &image);
+        PythonSupport::instance()->scaledImageFromRGBA(obj1, w * display_scaling, h * display_scaling, &image);
 
         if (image.image.isNull())
             return NULL;
 
-        float display_scaling = GetDisplayScaling();
-
         drag->setPixmap(QPixmap::fromImage(image.image));
         drag->setHotSpot(QPoint(int(x * display_scaling), int(y * display_scaling)));
     }
@@ -2805,7 +3214,7 @@ static PyObject *DrawingContext_paintRGBAToImage_binary(PyObject * /*self*/, PyO
     if (!PythonSupport::instance()->parse()(args, "w*OO", &buffer, &obj0, &arrayObject))
         return NULL;
 
-    QMap<QString, QVariant> imageMap = PyObjectToQVariant(obj0).toMap();
+    ImageBufferMap image_buffers = PinImageBuffers(obj0);
 
     int width = 0;
     int height = 0;
@@ -2822,9 +3231,9 @@ static PyObject *DrawingContext_paintRGBAToImage_binary(PyObject * /*self*/, PyO
 
         {
             QPainter painter(&image.image);
-            CommandsSharedPtr command_buffer(new std::vector<quint32>());
-            command_buffer->assign((quint32 *)buffer.buf, ((quint32 *)buffer.buf) + buffer.len / 4);
-            PaintBinaryCommands(&painter, command_buffer, imageMap, RenderedTimeStamps(), 1.0);
+            // painting completes before the buffer is released, so the commands can reference it directly.
+            CommandsSharedPtr command_buffer(new CommandBuffer((const quint32 *)buffer.buf, buffer.len / 4, nullptr));
+            PaintBinaryCommands(&painter, command_buffer, image_buffers, RenderedTimeStamps(), 1.0);
         }
 
         if (image.image.format() != QImage::Format_ARGB32_Premultiplied)
@@ -3768,14 +4177,17 @@ static PyObject *PushButton_setIcon(PyObject * /*self*/, PyObject *args)
 
     if (!PythonSupport::instance()->isNone(obj1))
     {
+        float display_scaling = GetDisplayScaling();
+
+        // average large images down to the device pixels of the icon rather than scaling them when painting.
+        const qreal device_pixel_ratio = qApp->devicePixelRatio();
+
         QImageInterface image;
-        PythonSupport::instance()->imageFromRGBA(obj1, &image);
+        PythonSupport::instance()->scaledImageFromRGBA(obj1, width * display_scaling * device_pixel_ratio, height * display_scaling * device_pixel_ratio, &image);
 
         if (image.image.isNull())
             return NULL;
 
-        float display_scaling = GetDisplayScaling();
-
         push_button->setIcon(QIcon(QPixmap::fromImage(image.image)));
         push_button->setIconSize(QSize(width * display_scaling, height * display_scaling));
     }
@@ -3925,14 +4337,17 @@ static PyObject *RadioButton_setIcon(PyObject * /*self*/, PyObject *args)
 
     if (!PythonSupport::instance()->isNone(obj1))
     {
+        float display_scaling = GetDisplayScaling();
+
+        // average large images down to the device pixels of the icon rather than scaling them when painting.
+        const qreal device_pixel_ratio = qApp->devicePixelRatio();
+
         QImageInterface image;
-        PythonSupport::instance()->imageFromRGBA(obj1, &image);
+        PythonSupport::instance()->scaledImageFromRGBA(obj1, width * display_scaling * device_pixel_ratio, height * display_scaling * device_pixel_ratio, &image);
 
         if (image.image.isNull())
             return NULL;
 
-        float display_scaling = GetDisplayScaling();
-
         radio_button->setIcon(QIcon(QPixmap::fromImage(image.image)));
         radio_button->setIconSize(QSize(width * display_scaling, height * display_scaling));
     }
@@ -6508,13 +6923,22 @@ static PyMethodDef Methods[] = {
     {"ComboBox_removeAllItems", ComboBox_removeAllItems, METH_VARARGS, "ComboBox_removeAllItems."},
     {"ComboBox_setCurrentText", ComboBox_setCurrentText, METH_VARARGS, "ComboBox_setCurrentText."},
 
+    {"Core_dumpTelemetry", Core_dumpTelemetry, METH_VARARGS, "Core_dumpTelemetry."},
+    {"Core_getCanvasBackBufferStats", Core_getCanvasBackBufferStats, METH_VARARGS, "Core_getCanvasBackBufferStats."},
+    {"Core_getCanvasProfile", Core_getCanvasProfile, METH_VARARGS, "Core_getCanvasProfile."},
     {"Core_getFontMetrics", Core_getFontMetrics, METH_VARARGS, "Core_getFontMetrics."},
     {"Core_getLocation", Core_getLocation, METH_VARARGS, "Core_getLocation."},
     {"Core_getQtVersion", Core_getQtVersion, METH_VARARGS, "Core_getQtVersion."},
     {"Core_getBuildVersion", Core_getBuildVersion, METH_VARARGS, "Core_getBuildVersion."},
+    {"Core_getTelemetry", Core_getTelemetry, METH_VARARGS, "Core_getTelemetry."},
     {"Core_out", Core_out, METH_VARARGS, "Core_out."},
     {"Core_pathToURL", Core_pathToURL, METH_VARARGS, "Core_pathToURL."},
+    {"Core_resetCanvasProfile", Core_resetCanvasProfile, METH_VARARGS, "Core_resetCanvasProfile."},
+    {"Core_resetTelemetry", Core_resetTelemetry, METH_VARARGS, "Core_resetTelemetry."},
     {"Core_setApplicationInfo", Core_setApplicationInfo, METH_VARARGS, "Core_setApplicationInfo."},
+    {"Core_setCanvasProfilingEnabled", Core_setCanvasProfilingEnabled, METH_VARARGS, "Core_setCanvasProfilingEnabled."},
+    {"Core_setCanvasTraceFile", Core_setCanvasTraceFile, METH_VARARGS, "Core_setCanvasTraceFile."},
+    {"Core_setImageRenderThreadCount", Core_setImageRenderThreadCount, METH_VARARGS, "Core_setImageRenderThreadCount."},
     {"Core_syncLatencyTimer", Core_syncLatencyTimer, METH_VARARGS, "Core_syncLatencyTimer"},
     {"Core_truncateToWidth", Core_truncateToWidth, METH_VARARGS, "Core_truncateToWidth."},
     {"Core_URLToPath", Core_URLToPath, METH_VARARGS, "Core_URLToPath."},
@@ -6743,6 +7167,34 @@ PyObject* InitializeHostLibModule()
     return module;
 }
 
+class QTaskRunner : public TaskRunner
+{
+public:
+    void run(int count, int thread_count, const std::function<void(int)> &fn)
+    {
+        // helpers are only started if the global thread pool has an idle thread. the calling
+        // thread always takes part and picks up any indexes the helpers do not get to, so this
+        // cannot deadlock even when it is called from a thread pool thread.
+        std::atomic<int> next_index(0);
+        auto work = [&]() {
+            for (int index = next_index++; index < count; index = next_index++)
+                fn(index);
+        };
+        QSemaphore finished;
+        int helper_count = 0;
+        for (int i = 1; i < qMin(count, thread_count); ++i)
+        {
+            if (!QThreadPool::globalInstance()->tryStart([&]() { work(); finished.release(); }))
+                break;
+            helper_count += 1;
+        }
+        work();
+        finished.acquire(helper_count);
+    }
+};
+
+static QTaskRunner image_task_runner;
+
 class QFileSystem : public FileSystem
 {
 public:
@@ -6845,6 +7297,11 @@ public:
     }
 };
 
+FileSystem *NewQFileSystem()
+{
+    return new QFileSystem();
+}
+
 bool Application::initialize()
 {
     if (arguments().length() < 2 || !QDir(arguments()[1]).exists())
@@ -6911,7 +7368,17 @@ bool Application::initialize()
         m_python_paths.append(m_python_home);
     }
 
-    FileSystem *fs = new QFileSystem();
+    ImageKernels::setTaskRunner(&image_task_runner);
+
+    // record the drawing commands submitted to canvases, for replay with the canvas benchmark.
+    if (qEnvironmentVariableIsSet("NIONUI_CANVAS_TRACE"))
+    {
+        QString canvas_trace_path = qEnvironmentVariable("NIONUI_CANVAS_TRACE");
+        if (!canvas_trace_writer.open(canvas_trace_path))
+            qDebug() << "Unable to open canvas trace file" << canvas_trace_path;
+    }
+
+    FileSystem *fs = NewQFileSystem();
 
     m_python_home = QString::fromStdString(PythonSupport::ensurePython(fs, m_python_home.toStdString()));
 #if !defined(DEBUG)
@@ -6978,6 +7445,8 @@ Application::~Application()
 
 void Application::deinitialize()
 {
+    canvas_trace_writer.close();
+    ClearImageCache();
     m_bootstrap_module.reset();
     m_py_application.reset();
     PythonSupport::instance()->deinitialize();
@@ -7021,9 +7490,59 @@ QVariant Application::getPyObjectAttribute(PyObjectPtr *object, const QString &a
 
 QVariant Application::dispatchPyMethod(const QVariant &object, const QString &method, const QVariantList &args)
 {
+    // call methods of Python objects directly through the method cache rather than through bootstrap_dispatch.
+    if (object.userType() == PyObjectPtr_metaId())
+    {
+        Python_ThreadBlock thread_block;
+
+        PyObject *py_object = object.value<PyObjectPtr>().get();
+        if (!py_object)
+            return QVariant();
+
+        // hold the target in case the call replaces it.
+        PyObjectPtr target(py_object, true);
+
+        std::vector<PyObject *> py_args;
+        bool err = false;
+        Q_FOREACH(const QVariant &arg, args)
+        {
+            PyObject *py_arg = QVariantToPyObject(arg);
+            if (!py_arg)
+            {
+                PythonSupport::instance()->printAndClearErrors();
+                err = true;
+                break;
+            }
+            py_args.push_back(py_arg);
+        }
+
+        QVariant result;
+        if (!err)
+        {
+            PyObject *py_result = PythonSupport::instance()->callMethod(target, method.toStdString(), py_args.data(), py_args.size());
+            if (py_result)
+            {
+                result = PyObjectToQVariant(py_result);
+                Py_DECREF(py_result);
+            }
+        }
+        for (PyObject *py_arg : py_args)
+            Py_DECREF(py_arg);
+        return result;
+    }
+
     return invokePyMethod(m_bootstrap_module.get(), "bootstrap_dispatch", QVariantList() << object << method << QVariant(args));
 }
 
+void ForgetPyMethods(const QVariant &py_object)
+{
+    if (py_object.userType() == PyObjectPtr_metaId())
+    {
+        Python_ThreadBlock thread_block;
+        PythonSupport::instance()->forgetMethods(py_object.value<PyObjectPtr>().get());
+    }
+}
+
 void Application::closeSplashScreen()
 {
     if (m_splash_screen)
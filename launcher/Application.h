@@ -15,8 +15,12 @@
 float GetDisplayScaling();
 
 class DocumentWindow;
+class FileSystem;
 class PyObjectPtr;
 
+// the file system used by PythonSupport to locate and load Python, implemented with Qt.
+FileSystem *NewQFileSystem();
+
 typedef QList<DocumentWindow *> DocumentWindowList;
 
 class Application : public QApplication
@@ -0,0 +1,182 @@
+/*
+ Copyright (c) 2012-2024 Bruker, Inc.
+*/
+
+#include "CanvasTrace.h"
+
+namespace
+{
+    void SetUpStream(QDataStream &stream)
+    {
+        stream.setVersion(QDataStream::Qt_6_0);
+        stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    }
+}
+
+CanvasTraceWriter::~CanvasTraceWriter()
+{
+    close();
+}
+
+bool CanvasTraceWriter::open(const QString &file_path)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (m_file.isOpen())
+        m_file.close();
+
+    m_image_keys.clear();
+    m_next_image_key = 1;
+
+    m_file.setFileName(file_path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    m_stream.setDevice(&m_file);
+    SetUpStream(m_stream);
+
+    m_stream << CanvasTrace::Magic << CanvasTrace::Version;
+
+    m_timer.start();
+
+    return true;
+}
+
+void CanvasTraceWriter::close()
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (m_file.isOpen())
+        m_file.close();
+
+    m_stream.setDevice(nullptr);
+    m_image_keys.clear();
+}
+
+bool CanvasTraceWriter::isOpen()
+{
+    QMutexLocker locker(&m_mutex);
+
+    return m_file.isOpen();
+}
+
+void CanvasTraceWriter::write(const CanvasTraceFrame &frame)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!m_file.isOpen() || !frame.commands)
+        return;
+
+    QList<QPair<int, int>> image_keys;
+
+    for (auto iter = frame.image_buffers.constBegin(); iter != frame.image_buffers.constEnd(); ++iter)
+    {
+        const ImageKernels::ImageBuffer &image_buffer = iter.value();
+        if (!image_buffer.isValid())
+            continue;
+
+        // identify images by content so that arrays drawn in many frames are only written once,
+        // while arrays modified in place are written again.
+        const size_t seed = qHashMulti(0, image_buffer.width, image_buffer.height, image_buffer.item_size, int(image_buffer.data_type));
+        const QPair<size_t, qint64> content_key(qHashBits(image_buffer.data, image_buffer.length, seed), image_buffer.length);
+
+        int image_key = m_image_keys.value(content_key, 0);
+        if (image_key == 0)
+        {
+            image_key = m_next_image_key++;
+            m_image_keys.insert(content_key, image_key);
+            m_stream << CanvasTrace::ImageRecord << qint32(image_key) << qint32(image_buffer.data_type);
+            m_stream << qint64(image_buffer.width) << qint64(image_buffer.height) << qint64(image_buffer.item_size);
+            m_stream << QByteArray::fromRawData(static_cast<const char *>(image_buffer.data), image_buffer.length);
+        }
+
+        image_keys.append(qMakePair(iter.key(), image_key));
+    }
+
+    m_stream << CanvasTrace::FrameRecord << qint64(m_timer.nsecsElapsed()) << qint32(frame.section_id) << frame.rect;
+    m_stream << frame.display_scaling << frame.device_pixel_ratio;
+    m_stream << QByteArray::fromRawData(reinterpret_cast<const char *>(frame.commands->data()), frame.commands->size() * 4);
+    m_stream << qint32(image_keys.size());
+    for (const auto &image_key : image_keys)
+        m_stream << qint32(image_key.first) << qint32(image_key.second);
+}
+
+bool CanvasTraceReader::open(const QString &file_path)
+{
+    m_file.setFileName(file_path);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return false;
+
+    m_stream.setDevice(&m_file);
+    SetUpStream(m_stream);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    m_stream >> magic >> version;
+
+    return m_stream.status() == QDataStream::Ok && magic == CanvasTrace::Magic && version == CanvasTrace::Version;
+}
+
+bool CanvasTraceReader::read(CanvasTraceFrame &frame)
+{
+    while (!m_stream.atEnd())
+    {
+        qint8 record_type = 0;
+        m_stream >> record_type;
+
+        if (record_type == CanvasTrace::ImageRecord)
+        {
+            qint32 image_key = 0;
+            qint32 data_type = 0;
+            qint64 width = 0;
+            qint64 height = 0;
+            qint64 item_size = 0;
+            auto data = std::make_shared<QByteArray>();
+            m_stream >> image_key >> data_type >> width >> height >> item_size >> *data;
+
+            ImageKernels::ImageBuffer image_buffer;
+            image_buffer.data = data->constData();
+            image_buffer.source = data->constData();
+            image_buffer.width = width;
+            image_buffer.height = height;
+            image_buffer.item_size = item_size;
+            image_buffer.length = data->size();
+            image_buffer.data_type = ImageKernels::DataType(data_type);
+            image_buffer.owner = data;
+            m_images[image_key] = image_buffer;
+        }
+        else if (record_type == CanvasTrace::FrameRecord)
+        {
+            QByteArray commands;
+            qint32 section_id = 0;
+            qint32 image_count = 0;
+            m_stream >> frame.timestamp_ns >> section_id >> frame.rect >> frame.display_scaling >> frame.device_pixel_ratio >> commands >> image_count;
+            frame.section_id = section_id;
+
+            frame.image_buffers.clear();
+            for (qint32 i = 0; i < image_count && m_stream.status() == QDataStream::Ok; ++i)
+            {
+                qint32 image_id = 0;
+                qint32 image_key = 0;
+                m_stream >> image_id >> image_key;
+                if (m_images.contains(image_key))
+                    frame.image_buffers[image_id] = m_images[image_key];
+            }
+
+            if (m_stream.status() != QDataStream::Ok)
+                return false;
+
+            frame.commands.reset(new CommandBuffer(reinterpret_cast<const quint32 *>(commands.constData()), commands.size() / 4));
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+
+        if (m_stream.status() != QDataStream::Ok)
+            return false;
+    }
+
+    return false;
+}
@@ -0,0 +1,92 @@
+/*
+ Copyright (c) 2012-2024 Bruker, Inc.
+*/
+
+#ifndef CANVAS_TRACE_H
+#define CANVAS_TRACE_H
+
+#include <QtCore/QDataStream>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QRect>
+#include <QtCore/QString>
+
+#include "DocumentWindow.h"
+
+/*
+ A canvas trace is a file of binary drawing command sections as submitted to a canvas, including
+ the image arrays they reference, so that the drawing can be replayed and measured offline.
+
+ The file is a QDataStream (version Qt_6_0, single precision floats) starting with the magic
+ number and the format version, followed by records each starting with a record type:
+
+   image record: 'I', image key (qint32), data type (qint32), width, height, item size (qint64),
+                 data (QByteArray). later frames refer to the image by its key, so that arrays
+                 drawn in many frames are stored once.
+   frame record: 'F', timestamp ns (qint64), section id (qint32), rect (QRect, device independent
+                 pixels times display scaling), display scaling (float), device pixel ratio (float),
+                 commands (QByteArray of 32-bit words), image count (qint32), then image count
+                 pairs of image id (qint32) and image key (qint32).
+ */
+
+struct CanvasTraceFrame
+{
+    qint64 timestamp_ns = 0;
+    int section_id = 0;
+    QRect rect;
+    float display_scaling = 1.0;
+    float device_pixel_ratio = 1.0;
+    CommandsSharedPtr commands;
+    ImageBufferMap image_buffers;
+};
+
+// writes frames to a trace file. frames may be written from any thread.
+class CanvasTraceWriter
+{
+public:
+    ~CanvasTraceWriter();
+
+    // start a new trace file, closing the current one, if any.
+    bool open(const QString &file_path);
+    void close();
+    bool isOpen();
+
+    // write a frame, stamped with the time since the trace was opened, and the images it references.
+    void write(const CanvasTraceFrame &frame);
+
+private:
+    QMutex m_mutex;
+    QFile m_file;
+    QDataStream m_stream;
+    QElapsedTimer m_timer;
+    QHash<QPair<size_t, qint64>, int> m_image_keys;  // image content hash and length to image key
+    int m_next_image_key = 1;
+};
+
+class CanvasTraceReader
+{
+public:
+    bool open(const QString &file_path);
+
+    // read the next frame; returns false at the end of the trace or if the trace is invalid.
+    // the timestamp of the frame is the time since the trace was opened when the frame was written.
+    bool read(CanvasTraceFrame &frame);
+
+private:
+    QFile m_file;
+    QDataStream m_stream;
+    QMap<int, ImageKernels::ImageBuffer> m_images;
+};
+
+namespace CanvasTrace
+{
+    const quint32 Magic = 0x4e435452;  // NCTR
+    const quint32 Version = 1;
+    const qint8 ImageRecord = 'I';
+    const qint8 FrameRecord = 'F';
+}
+
+#endif
@@ -3,6 +3,9 @@
  */
 
 #include <stdint.h>
+#include <string.h>
+
+#include <atomic>
 
 #if defined(__APPLE__)
 #include <mach/mach_time.h> /* mach_absolute_time */
@@ -19,6 +22,7 @@
 #include <QtCore/QDateTime>
 #include <QtCore/QDebug>
 #include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
 #include <QtCore/QMimeData>
 #include <QtCore/QQueue>
 #include <QtCore/QRegularExpression>
@@ -34,6 +38,7 @@
 #include <QtGui/QPainter>
 #include <QtGui/QPainterPath>
 #include <QtGui/QScreen>
+#include <QtGui/QStaticText>
 #include <QtGui/QStyleHints>
 #include <QtGui/QWindow>
 
@@ -75,78 +80,453 @@ const auto DEFAULT_RENDER_HINTS = QPainter::Antialiasing | QPainter::TextAntiali
 
 QFont ParseFontString(const QString &font_string, float display_scaling = 1.0);
 
+namespace
+{
+    // parse an unsigned decimal integer at index, skipping surrounding spaces. values are saturated
+    // at an out of range value so that QColor rejects them as it would any other out of range value.
+    bool ParseColorComponent(QStringView s, qsizetype &index, int &value)
+    {
+        while (index < s.size() && s[index] == QLatin1Char(' '))
+            index++;
+        qsizetype start = index;
+        value = 0;
+        while (index < s.size() && s[index] >= QLatin1Char('0') && s[index] <= QLatin1Char('9'))
+        {
+            value = qMin(value * 10 + (s[index].unicode() - '0'), 0x10000);
+            index++;
+        }
+        if (index == start)
+            return false;
+        while (index < s.size() && s[index] == QLatin1Char(' '))
+            index++;
+        return true;
+    }
+
+    int HexDigitValue(QChar c)
+    {
+        const char16_t u = c.unicode();
+        if (u >= '0' && u <= '9')
+            return u - '0';
+        if (u >= 'a' && u <= 'f')
+            return u - 'a' + 10;
+        if (u >= 'A' && u <= 'F')
+            return u - 'A' + 10;
+        return -1;
+    }
+
+    // parse the arguments of rgb(r, g, b) or rgba(r, g, b, a) starting after the opening parenthesis.
+    bool ParseColorFunction(QStringView s, qsizetype index, bool has_alpha, QColor &color)
+    {
+        int r, g, b;
+        if (!ParseColorComponent(s, index, r) || index >= s.size() || s[index++] != QLatin1Char(','))
+            return false;
+        if (!ParseColorComponent(s, index, g) || index >= s.size() || s[index++] != QLatin1Char(','))
+            return false;
+        if (!ParseColorComponent(s, index, b))
+            return false;
+        if (!has_alpha)
+        {
+            if (index != s.size() - 1 || s[index] != QLatin1Char(')'))
+                return false;
+            color = QColor(r, g, b);
+            return true;
+        }
+        if (index >= s.size() || s[index++] != QLatin1Char(','))
+            return false;
+        qsizetype alpha_end = s.size() - 1;
+        if (alpha_end <= index || s[alpha_end] != QLatin1Char(')'))
+            return false;
+        bool ok = false;
+        float a = s.mid(index, alpha_end - index).trimmed().toFloat(&ok);
+        if (!ok)
+            return false;
+        color = QColor(r, g, b, a * 255);
+        return true;
+    }
+}
+
+/*
+ Parse a CSS style color string: #rgb, #rrggbb, rgb(r, g, b), rgba(r, g, b, a), or a color name.
+ Strings in other forms are passed to QColor, which leaves the color invalid if it cannot parse them.
+ */
 QColor ParseColorString(const QString &color_string)
 {
+    QStringView s(color_string);
+
+    if (s.size() == 4 || s.size() == 7)
+    {
+        if (s[0] == QLatin1Char('#'))
+        {
+            int digits[6];
+            bool valid = true;
+            for (qsizetype i = 1; i < s.size(); ++i)
+            {
+                digits[i - 1] = HexDigitValue(s[i]);
+                valid = valid && digits[i - 1] >= 0;
+            }
+            if (valid)
+            {
+                if (s.size() == 4)
+                    return QColor(digits[0] * 17, digits[1] * 17, digits[2] * 17);
+                return QColor(digits[0] * 16 + digits[1], digits[2] * 16 + digits[3], digits[4] * 16 + digits[5]);
+            }
+        }
+    }
+
     QColor color;
-    QRegularExpression re1("^rgba\\((\\d+),\\s*(\\d+),\\s*(\\d+),\\s*(\\d+\\.\\d+)\\)$");
-    QRegularExpression re2("^rgb\\((\\d+),\\s*(\\d+),\\s*(\\d+)\\)$");
-    QRegularExpressionMatch match1 = re1.match(color_string);
-    QRegularExpressionMatch match2 = re2.match(color_string);
-    if (match1.hasMatch())
-        color = QColor(match1.captured(1).toInt(), match1.captured(2).toInt(), match1.captured(3).toInt(), match1.captured(4).toFloat() * 255);
-    else if (match2.hasMatch())
-        color = QColor(match2.captured(1).toInt(), match2.captured(2).toInt(), match2.captured(3).toInt());
-    else
-        color = QColor(color_string);
-    return color;
+    if (s.startsWith(QLatin1String("rgba(")) && ParseColorFunction(s, 5, true, color))
+        return color;
+    if (s.startsWith(QLatin1String("rgb(")) && ParseColorFunction(s, 4, false, color))
+        return color;
+
+    return QColor(color_string);
+}
+
+// A process-wide cache of images scaled from arrays by the imag command, so that arrays
+// drawn again in later frames (overlays, thumbnails) are not scaled again. Unscaled images
+// are a copy of the rows and are not worth caching. Entries are keyed by the address of the
+// source array and the destination size, and hold a hash of the array contents which must
+// match for the entry to be used, so that arrays modified in place, or another array at the
+// same address, are converted again. Entries do not keep the source array alive, which would
+// keep its buffer exported and prevent resizing it. Hashing reads the array once, which is
+// much cheaper than scaling it. The cache is bounded by the bytes of its images and evicts
+// the least recently used entries.
+struct ImageCacheKey
+{
+    const void *source;
+    int width;
+    int height;
+    QSize size;
+
+    bool operator==(const ImageCacheKey &other) const
+    {
+        return source == other.source && width == other.width && height == other.height && size == other.size;
+    }
+};
+
+size_t qHash(const ImageCacheKey &key, size_t seed = 0)
+{
+    return qHashMulti(seed, quintptr(key.source), key.width, key.height, key.size.width(), key.size.height());
 }
 
-class RepaintManager
+class ImageCache
 {
 public:
-    RepaintManager()
+    typedef ImageCacheKey Key;
+
+    bool find(const Key &key, size_t content_hash, QImage *image)
     {
+        QMutexLocker locker(&mutex);
+
+        auto iter = index.find(key);
+        if (iter == index.end() || iter.value()->content_hash != content_hash)
+            return false;
+
+        entries.splice(entries.begin(), entries, iter.value());
+        *image = iter.value()->image;
+        return true;
     }
 
-    void requestRepaint(PyCanvas *canvas)
+    void insert(const Key &key, size_t content_hash, const QImage &image)
     {
         QMutexLocker locker(&mutex);
 
-        for (const auto &r : requests)
+        auto iter = index.find(key);
+        if (iter != index.end())
         {
-            if (r == canvas)
-                return;
+            bytes -= iter.value()->bytes;
+            entries.erase(iter.value());
+            index.erase(iter);
         }
 
-        requests.push_back(canvas);
+        const qint64 entry_bytes = image.sizeInBytes();
+        if (entry_bytes <= max_bytes)
+        {
+            entries.push_front({key, content_hash, image, entry_bytes});
+            index.insert(key, entries.begin());
+            bytes += entry_bytes;
+        }
+
+        while (bytes > max_bytes)
+        {
+            const Entry &entry = entries.back();
+            bytes -= entry.bytes;
+            index.remove(entry.key);
+            entries.pop_back();
+        }
     }
 
-    void cancelRepaintRequest(PyCanvas *canvas)
+    void clear()
     {
-        QMutexLocker locker(&mutex);
+        std::list<Entry> released_entries;
+
+        {
+            QMutexLocker locker(&mutex);
+            released_entries.swap(entries);
+            index.clear();
+            bytes = 0;
+        }
+    }
+
+private:
+    struct Entry
+    {
+        Key key;
+        size_t content_hash;
+        QImage image;
+        qint64 bytes;
+    };
+
+    QMutex mutex;
+    std::list<Entry> entries;  // most recently used first
+    QHash<Key, std::list<Entry>::iterator> index;
+    qint64 bytes = 0;
+    const qint64 max_bytes = 256 * 1024 * 1024;
+};
 
-        std::list<PyCanvas *> new_requests;
+ImageCache imageCache;
+
+// draw a scatter marker of a size in device pixels centered at the origin of the painter.
+// shapes: 0 circle, 1 square, 2 diamond, 3 triangle, 4 plus, 5 cross.
+static void DrawMarker(QPainter &painter, quint32 shape, qreal size, const QColor &color)
+{
+    const qreal r = size / 2.0;
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(color);
+    switch (shape)
+    {
+        case 1:
+            painter.drawRect(QRectF(-r, -r, size, size));
+            break;
+        case 2:
+            painter.drawPolygon(QPolygonF({QPointF(0, -r), QPointF(r, 0), QPointF(0, r), QPointF(-r, 0)}));
+            break;
+        case 3:
+            painter.drawPolygon(QPolygonF({QPointF(0, -r), QPointF(r * 0.866, r * 0.5), QPointF(-r * 0.866, r * 0.5)}));
+            break;
+        case 4:
+        case 5:
+        {
+            QPen pen(color, qMax(1.0, size / 5.0));
+            pen.setCapStyle(Qt::FlatCap);
+            painter.setPen(pen);
+            if (shape == 5)
+                painter.rotate(45);
+            painter.drawLine(QPointF(-r, 0), QPointF(r, 0));
+            painter.drawLine(QPointF(0, -r), QPointF(0, r));
+            break;
+        }
+        default:
+            painter.drawEllipse(QPointF(0, 0), r, r);
+            break;
+    }
+}
+
+// markers larger than this many device pixels are drawn directly rather than from sprites.
+const qreal MAXIMUM_MARKER_SPRITE_SIZE = 256;
+
+// Marker sprites for the scatter command, rasterized once per shape, device pixel size (in half pixels)
+// and color. The cache is shared by the render threads and is cleared when it fills up.
+struct MarkerSpriteKey
+{
+    quint32 shape;
+    int half_pixels;
+    QRgb color;
+
+    bool operator==(const MarkerSpriteKey &other) const
+    {
+        return shape == other.shape && half_pixels == other.half_pixels && color == other.color;
+    }
+};
+
+size_t qHash(const MarkerSpriteKey &key, size_t seed = 0)
+{
+    return qHashMulti(seed, key.shape, key.half_pixels, key.color);
+}
+
+class MarkerSpriteCache
+{
+public:
+    typedef MarkerSpriteKey Key;
+
+    QImage sprite(const Key &key)
+    {
+        {
+            QMutexLocker locker(&mutex);
+            auto iter = sprites.constFind(key);
+            if (iter != sprites.constEnd())
+                return iter.value();
+        }
+
+        QImage sprite = rasterize(key);
 
-        for (const auto &r : requests)
         {
-            if (r != canvas)
-                new_requests.push_back(r);
+            QMutexLocker locker(&mutex);
+            if (sprites.size() >= max_count)
+                sprites.clear();
+            sprites.insert(key, sprite);
         }
 
-        requests = new_requests;
+        return sprite;
     }
 
-    void update()
+    void clear()
     {
-        // ideally only the passed widget could be updated; the widget may be a QDockWidget
-        // which never calls update; so as a workaround, just update everything and clear the list.
-        // this may be a problem (too many updates) in the future with multiple document windows.
         QMutexLocker locker(&mutex);
+        sprites.clear();
+    }
+
+private:
+    // sprites are at most MAXIMUM_MARKER_SPRITE_SIZE device pixels, plus a margin for antialiasing.
+    static QImage rasterize(const Key &key)
+    {
+        const qreal size = qMin(key.half_pixels / 2.0, MAXIMUM_MARKER_SPRITE_SIZE);
+        const int extent = int(ceil(size)) + 2;
+        QImage sprite(extent, extent, QImage::Format_ARGB32_Premultiplied);
+        sprite.fill(Qt::transparent);
+        QPainter painter(&sprite);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.translate(extent / 2.0, extent / 2.0);
+        DrawMarker(painter, key.shape, size, QColor::fromRgba(key.color));
+        painter.end();
+        return sprite;
+    }
+
+    QMutex mutex;
+    QHash<Key, QImage> sprites;
+    const qsizetype max_count = 1024;
+};
+
+MarkerSpriteCache markerSpriteCache;
+
+// The layout of canvas text: the shaped text prepared for drawing with a transform, its metrics, and
+// optionally its outline at the origin, for stroked text.
+struct TextLayout
+{
+    QStaticText static_text;
+    int advance = 0;
+    int ascent = 0;
+    int height = 0;
+    int x_height = 0;
+    std::shared_ptr<const QPainterPath> path;
+};
+
+// Text layouts shared across frames, sections and canvases, keyed on the text, the font and the
+// scale and rotation of the painter transform (including the device pixel ratio). The layout is
+// prepared for the transform so that it is not laid out again when drawn. Static text drawn on
+// another thread than the one it was laid out on is laid out again in place, which is not safe
+// while another thread draws it, so layouts are also keyed on the rendering thread. The cache is
+// bounded by the number of entries and evicts the least recently used entries.
+struct TextLayoutKey
+{
+    const void *thread;
+    QString text;
+    QString font;
+    qreal m11;
+    qreal m12;
+    qreal m21;
+    qreal m22;
+
+    bool operator==(const TextLayoutKey &other) const
+    {
+        return thread == other.thread && text == other.text && font == other.font && m11 == other.m11 && m12 == other.m12 && m21 == other.m21 && m22 == other.m22;
+    }
+};
+
+size_t qHash(const TextLayoutKey &key, size_t seed = 0)
+{
+    return qHashMulti(seed, quintptr(key.thread), key.text, key.font, key.m11, key.m12, key.m21, key.m22);
+}
+
+class TextLayoutCache
+{
+public:
+    typedef TextLayoutKey Key;
+
+    TextLayout layout(const QString &text, const QFont &font, const QTransform &transform, bool with_path)
+    {
+        const Key key{QThread::currentThread(), text, font.key(), transform.m11(), transform.m12(), transform.m21(), transform.m22()};
+
+        {
+            QMutexLocker locker(&mutex);
+
+            auto iter = index.find(key);
+            if (iter != index.end() && (!with_path || iter.value()->layout.path))
+            {
+                entries.splice(entries.begin(), entries, iter.value());
+                return iter.value()->layout;
+            }
+        }
 
-        for (const auto &r : requests)
+        // lay out the text outside of the lock.
+        TextLayout layout;
+        QFontMetrics fm(font);
+        layout.advance = fm.horizontalAdvance(text);
+        layout.ascent = fm.ascent();
+        layout.height = fm.height();
+        layout.x_height = fm.xHeight();
+        layout.static_text.setText(text);
+        layout.static_text.setTextFormat(Qt::PlainText);
+        layout.static_text.setPerformanceHint(QStaticText::AggressiveCaching);
+        layout.static_text.prepare(QTransform(transform.m11(), transform.m12(), transform.m21(), transform.m22(), 0, 0), font);
+        if (with_path)
         {
-            r->update();
+            auto path = std::make_shared<QPainterPath>();
+            path->addText(QPointF(), font, text);
+            layout.path = path;
         }
 
-        requests.clear();
+        {
+            QMutexLocker locker(&mutex);
+
+            auto iter = index.find(key);
+            if (iter != index.end())
+            {
+                entries.erase(iter.value());
+                index.erase(iter);
+            }
+
+            entries.push_front({key, layout});
+            index.insert(key, entries.begin());
+
+            while (entries.size() > max_count)
+            {
+                index.remove(entries.back().key);
+                entries.pop_back();
+            }
+        }
+
+        return layout;
+    }
+
+    void clear()
+    {
+        QMutexLocker locker(&mutex);
+        entries.clear();
+        index.clear();
     }
 
 private:
+    struct Entry
+    {
+        Key key;
+        TextLayout layout;
+    };
+
     QMutex mutex;
-    std::list<PyCanvas *> requests;
+    std::list<Entry> entries;  // most recently used first
+    QHash<Key, std::list<Entry>::iterator> index;
+    const size_t max_count = 4096;
 };
 
-RepaintManager repaintManager;
+TextLayoutCache textLayoutCache;
+
+void ClearImageCache()
+{
+    imageCache.clear();
+    markerSpriteCache.clear();
+    textLayoutCache.clear();
+}
 
 DocumentWindow::DocumentWindow(const QString &title, QWidget *parent)
     : QMainWindow(parent)
@@ -192,7 +572,6 @@ void DocumentWindow::timerEvent(QTimerEvent *event)
 {
     if (event->timerId() == m_periodic_timer && isVisible())
     {
-        repaintManager.update();
         application()->dispatchPyMethod(m_py_object, "periodic", QVariantList());
     }
 }
@@ -1464,16 +1843,15 @@ void PaintCommands(QPainter &painter, const QList<CanvasDrawingCommand> &command
                 PyObjectPtr ndarray_py(QVariantToPyObject(args[2]));
                 if (ndarray_py)
                 {
-                    PythonSupport::instance()->imageFromRGBA(ndarray_py, &image);
+                    if (destination_size.width() < width * 0.75 || destination_size.height() < height * 0.75)
+                        PythonSupport::instance()->scaledImageFromRGBA(ndarray_py, destination_size.width(), destination_size.height(), &image);
+                    else
+                        PythonSupport::instance()->imageFromRGBA(ndarray_py, &image);
                 }
             }
 
             if (!image.image.isNull())
             {
-                if (destination_size.width() < width * 0.75 || destination_size.height() < height * 0.75)
-                {
-                    image.image = image.image.scaled((destination_rect.size() * context_scaling).toSize(), Qt::KeepAspectRatio, Qt::SmoothTransformation);
-                }
                 painter.drawImage(destination_rect, image.image);
             }
         }
@@ -1689,56 +2067,157 @@ inline bool read_bool(const quint32 *commands, unsigned int &command_index)
     return *(quint32 *)(&commands[command_index++]) != 0;
 }
 
-inline QString read_string(const quint32 *commands, unsigned int &command_index)
-{
-    quint32 str_len = read_uint32(commands, command_index);
-    QString str = QString::fromUtf8((const char *)&commands[command_index], str_len);
-    command_index += ((str_len + 3) & 0xFFFFFFFC) / 4;
-    return str;
-}
-
 struct NullDeleter {template<typename T> void operator()(T*) {} };
 
-RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsSharedPtr &commands_v, const QMap<QString, QVariant> &imageMap, const RenderedTimeStamps &lastRenderedTimestamps, float display_scaling, int section_id, float devicePixelRatio)
+// A process-wide memo of the colors and fonts parsed from the style strings of binary drawing
+// commands. Clients typically send the same few style strings every frame, so the memo avoids
+// parsing them again. The memo is bounded; it is cleared when it grows too large.
+class StyleMemo
 {
-    QSharedPointer<QPainter> painter(rawPainter, NullDeleter());
+public:
+    QColor color(const QByteArray &color_string)
+    {
+        {
+            QMutexLocker locker(&mutex);
+            auto iter = colors.constFind(color_string);
+            if (iter != colors.constEnd())
+                return iter.value();
+        }
 
-    RenderedTimeStamps rendered_timestamps;
+        QColor color = ParseColorString(QString::fromUtf8(color_string).simplified());
 
-    display_scaling = display_scaling ? display_scaling : GetDisplayScaling();
+        {
+            QMutexLocker locker(&mutex);
+            if (colors.size() >= max_entries)
+                colors.clear();
+            colors.insert(QByteArray(color_string.constData(), color_string.size()), color);
+        }
 
-    QPainterPath path;
+        return color;
+    }
 
-    QColor fill_color(Qt::transparent);
-    int fill_gradient = -1;
+    QFont font(const QByteArray &font_string, float display_scaling)
+    {
+        {
+            QMutexLocker locker(&mutex);
+            auto iter = fonts.constFind(qMakePair(font_string, display_scaling));
+            if (iter != fonts.constEnd())
+                return iter.value();
+        }
 
-    QColor line_color(Qt::black);
-    float line_width = 1.0;
-    float line_dash = 0.0;
-    Qt::PenCapStyle line_cap = Qt::SquareCap;
-    Qt::PenJoinStyle line_join = Qt::BevelJoin;
+        QFont font = ParseFontString(QString::fromUtf8(font_string), display_scaling);
 
-    QFont text_font;
-    int text_baseline = 4; // alphabetic
-    int text_align = 1; // start
+        {
+            QMutexLocker locker(&mutex);
+            if (fonts.size() >= max_entries)
+                fonts.clear();
+            fonts.insert(qMakePair(QByteArray(font_string.constData(), font_string.size()), display_scaling), font);
+        }
 
-    float context_scaling_x = 1.0;
-    float context_scaling_y = 1.0;
+        return font;
+    }
 
-    QMap<int, QGradient> gradients;
+private:
+    QMutex mutex;
+    QHash<QByteArray, QColor> colors;
+    QHash<QPair<QByteArray, float>, QFont> fonts;
+    const int max_entries = 1024;
+};
 
-    painter->fillRect(painter->viewport(), QBrush(fill_color));
+StyleMemo styleMemo;
 
-    QList<DrawingContextState> stack;
+// A binary drawing command stream decoded into an array of operations. Numeric arguments are
+// read from the command stream starting at args_index. String arguments are resolved during
+// decoding: style strings to colors, fonts, and enumerated values (-1 if not recognized) and
+// other strings to QString.
+struct DecodedCommand
+{
+    quint32 cmd;
+    unsigned int args_index;
+    int value;  // enumerated value or index into the colors, fonts, or strings of the decoded commands
+};
 
-    unsigned int command_index = 0;
+struct DecodedCommands
+{
+    std::vector<DecodedCommand> commands;
+    std::vector<QColor> colors;
+    std::vector<QFont> fonts;
+    std::vector<QString> strings;
+};
 
-    const quint32 *commands = commands_v->data();
+// the number of 32-bit words of the numeric arguments of each command, preceding any string argument.
+// this must match the words read by each command in PaintBinaryCommands, which asserts it. the commands
+// not listed have no numeric arguments (save, rest, bpth, cpth, strk, fill, and the commands with only a
+// string argument), or are decoded separately (text and stxt, whose arguments follow the string).
+static unsigned int BinaryCommandArgumentCount(quint32 cmd)
+{
+    switch (cmd)
+    {
+        case 0x636c6970: return 4; // clip
+        case 0x7472616e: return 2; // tran
+        case 0x7363616c: return 2; // scal
+        case 0x726f7461: return 1; // rota
+        case 0x6d6f7665: return 2; // move
+        case 0x6c696e65: return 2; // line
+        case 0x72656374: return 4; // rect
+        case 0x61726320: return 6; // arc
+        case 0x61726374: return 5; // arct
+        case 0x63756263: return 6; // cubc
+        case 0x71756164: return 4; // quad
+        case 0x696d6167: return 7; // imag
+        case 0x64617461: return 10; // data
+        case 0x646c696e: return 9; // dlin
+        case 0x706c696e: return 1; // plin
+        case 0x70676f6e: return 1; // pgon
+        case 0x73637472: return 4; // sctr
+        case 0x666c7367: return 1; // flsg
+        case 0x6c647368: return 1; // ldsh
+        case 0x6c696e77: return 1; // linw
+        case 0x67726164: return 7; // grad
+        case 0x67726373: return 2; // grcs
+        case 0x736c6570: return 1; // slep
+        case 0x6c61746e: return 2; // latn
+        default: return 0;
+    }
+}
+
+// the raw bytes of a string argument, without copying. returns false if the string extends past the end of the commands.
+static bool read_string_bytes(const quint32 *commands, size_t size, unsigned int &command_index, QByteArray &bytes)
+{
+    if (command_index >= size)
+        return false;
+    quint32 str_len = read_uint32(commands, command_index);
+    quint32 str_words = ((str_len + 3) & 0xFFFFFFFC) / 4;
+    if (str_words > size - command_index)
+        return false;
+    bytes = QByteArray::fromRawData((const char *)&commands[command_index], str_len);
+    command_index += str_words;
+    return true;
+}
 
-    extern QElapsedTimer timer;
-    extern qint64 timer_offset_ns;
+// the histogram of the stat command with the label. the histograms are cached per thread so that the
+// registry is not locked for each command.
+static Telemetry::HistogramSharedPtr StatHistogram(const QString &label)
+{
+    thread_local QHash<QString, Telemetry::HistogramSharedPtr> histograms;
+    auto iter = histograms.constFind(label);
+    if (iter != histograms.constEnd())
+        return iter.value();
+    if (histograms.size() >= 256)
+        histograms.clear();
+    auto histogram = Telemetry::histogram("stat." + label);
+    histograms.insert(label, histogram);
+    return histogram;
+}
+
+static void DecodeBinaryCommands(const CommandBuffer &command_buffer, float display_scaling, DecodedCommands &decoded)
+{
+    const quint32 *commands = command_buffer.data();
+    const size_t size = command_buffer.size();
+
+    unsigned int command_index = 0;
 
-    while (command_index < commands_v->size())
+    while (command_index < size)
     {
         quint32 cmd_hex = read_uint32(commands, command_index);
         quint32 cmd = (cmd_hex & 0x000000FF) << 24 |
@@ -1746,57 +2225,335 @@ RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsShare
                       (cmd_hex & 0x00FF0000) >> 8 |
                       (cmd_hex & 0xFF000000) >> 24;
 
-        // qint64 start = qint64(timer.nsecsElapsed() / 1.0E3);
+        DecodedCommand decoded_command{cmd, command_index, -1};
+
+        unsigned int argument_count = BinaryCommandArgumentCount(cmd);
+        if (argument_count > size - command_index)
+            break;
+        command_index += argument_count;
+
+        QByteArray arg;
 
         switch (cmd)
         {
-            case 0x73617665:  // save
+            case 0x666c7374: // flst, fill style
+            case 0x73747374: // stst, strokeStyle
             {
-                DrawingContextState values;
-                values.fill_color = fill_color;
-                values.fill_gradient = fill_gradient;
-                values.line_color = line_color;
-                values.line_width = line_width;
-                values.line_dash = line_dash;
-                values.line_cap = line_cap;
-                values.line_join = line_join;
-                values.text_font = text_font;
-                values.text_baseline = text_baseline;
-                values.text_align = text_align;
-                values.gradients = gradients;
-                values.path = path;
-                values.context_scaling_x = context_scaling_x;
-                values.context_scaling_y = context_scaling_y;
-                stack.push_back(values);
-                painter->save();
+                if (!read_string_bytes(commands, size, command_index, arg))
+                    return;
+                decoded_command.value = int(decoded.colors.size());
+                decoded.colors.push_back(styleMemo.color(arg));
                 break;
             }
-            case 0x72657374:  // rest, restore
+            case 0x67726373: // grcs, colorStop
             {
-                DrawingContextState values = stack.takeLast();
-                fill_color = values.fill_color;
-                fill_gradient = values.fill_gradient;
-                line_color = values.line_color;
-                line_width = values.line_width;
-                line_dash = values.line_dash;
-                line_cap = values.line_cap;
-                line_join = values.line_join;
-                text_font = values.text_font;
-                text_baseline = values.text_baseline;
-                text_align = values.text_align;
-                gradients = values.gradients;
-                path = values.path;
-                context_scaling_x = values.context_scaling_x;
-                context_scaling_y = values.context_scaling_y;
-                painter->restore();
+                if (!read_string_bytes(commands, size, command_index, arg))
+                    return;
+                decoded_command.value = int(decoded.colors.size());
+                decoded.colors.push_back(QColor(QString::fromUtf8(arg)));
                 break;
             }
-            case 0x62707468: // bpth, begin path
+            case 0x666f6e74: // font
             {
-                path = QPainterPath();
+                if (!read_string_bytes(commands, size, command_index, arg))
+                    return;
+                decoded_command.value = int(decoded.fonts.size());
+                decoded.fonts.push_back(styleMemo.font(arg, display_scaling));
                 break;
             }
-            case 0x63707468: // cpth, close path
+            case 0x616c676e: // algn, text align
+            {
+                if (!read_string_bytes(commands, size, command_index, arg))
+                    return;
+                if (arg == "start")
+                    decoded_command.value = 1;
+                else if (arg == "end")
+                    decoded_command.value = 2;
+                else if (arg == "left")
+                    decoded_command.value = 3;
+                else if (arg == "center")
+                    decoded_command.value = 4;
+                else if (arg == "right")
+                    decoded_command.value = 5;
+                break;
+            }
+            case 0x74626173: // tbas, textBaseline
+            {
+                if (!read_string_bytes(commands, size, command_index, arg))
+                    return;
+                if (arg == "top")
+                    decoded_command.value = 1;
+                else if (arg == "hanging")
+                    decoded_command.value = 2;
+                else if (arg == "middle")
+                    decoded_command.value = 3;
+                else if (arg == "alphabetic")
+                    decoded_command.value = 4;
+                else if (arg == "ideographic")
+                    decoded_command.value = 5;
+                else if (arg == "bottom")
+                    decoded_command.value = 6;
+                break;
+            }
+            case 0x6c636170: // lcap, lineCap
+            {
+                if (!read_string_bytes(commands, size, command_index, arg))
+                    return;
+                if (arg == "square")
+                    decoded_command.value = Qt::SquareCap;
+                else if (arg == "round")
+                    decoded_command.value = Qt::RoundCap;
+                else if (arg == "butt")
+                    decoded_command.value = Qt::FlatCap;
+                break;
+            }
+            case 0x6c6e6a6e: // lnjn, lineJoin
+            {
+                if (!read_string_bytes(commands, size, command_index, arg))
+                    return;
+                if (arg == "round")
+                    decoded_command.value = Qt::RoundJoin;
+                else if (arg == "miter")
+                    decoded_command.value = Qt::MiterJoin;
+                else if (arg == "bevel")
+                    decoded_command.value = Qt::BevelJoin;
+                break;
+            }
+            case 0x74657874:
+            case 0x73747874: // text, stxt; fill text, stroke text
+            {
+                if (!read_string_bytes(commands, size, command_index, arg) || size - command_index < 3)
+                    return;
+                decoded_command.value = int(decoded.strings.size());
+                decoded.strings.push_back(QString::fromUtf8(arg));
+                decoded_command.args_index = command_index;
+                command_index += 3;
+                break;
+            }
+            case 0x706c696e:
+            case 0x70676f6e: // plin, pgon; polyline, polygon
+            {
+                // the point count is followed by the packed coordinates of the points.
+                unsigned int count_index = decoded_command.args_index;
+                quint32 point_count = read_uint32(commands, count_index);
+                if (point_count > (size - command_index) / 2)
+                    return;
+                command_index += point_count * 2;
+                break;
+            }
+            case 0x73746174: // stat, statistics
+            case 0x6d657367: // mesg, message
+            case 0x74696d65: // time
+            {
+                if (!read_string_bytes(commands, size, command_index, arg))
+                    return;
+                decoded_command.value = int(decoded.strings.size());
+                decoded.strings.push_back(QString::fromUtf8(arg));
+                break;
+            }
+        }
+
+        decoded.commands.push_back(decoded_command);
+    }
+}
+
+// A process-wide registry of command profiles per canvas section, filled in by the render tasks while enabled.
+class CanvasProfiler
+{
+public:
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    void setEnabled(bool enabled) { this->enabled.store(enabled, std::memory_order_relaxed); }
+
+    void add(int section_id, const CommandProfile &profile)
+    {
+        QMutexLocker locker(&mutex);
+
+        CommandProfile &section_profile = profiles[section_id];
+        for (auto iter = profile.constBegin(); iter != profile.constEnd(); ++iter)
+        {
+            CommandTiming &timing = section_profile[iter.key()];
+            timing.count += iter.value().count;
+            timing.elapsed_ns += iter.value().elapsed_ns;
+        }
+    }
+
+    QMap<int, CommandProfile> get()
+    {
+        QMutexLocker locker(&mutex);
+        return profiles;
+    }
+
+    void reset()
+    {
+        QMutexLocker locker(&mutex);
+        profiles.clear();
+    }
+
+private:
+    std::atomic<bool> enabled{false};
+    QMutex mutex;
+    QMap<int, CommandProfile> profiles;
+};
+
+CanvasProfiler canvasProfiler;
+
+void SetCanvasProfilingEnabled(bool enabled)
+{
+    canvasProfiler.setEnabled(enabled);
+}
+
+QMap<int, CommandProfile> CanvasProfiles()
+{
+    return canvasProfiler.get();
+}
+
+void ResetCanvasProfiles()
+{
+    canvasProfiler.reset();
+}
+
+std::atomic<qint64> back_buffer_hits{0};
+std::atomic<qint64> back_buffer_misses{0};
+
+BackBufferStats CanvasBackBufferStats()
+{
+    BackBufferStats stats;
+    stats.hits = back_buffer_hits.load(std::memory_order_relaxed);
+    stats.misses = back_buffer_misses.load(std::memory_order_relaxed);
+    return stats;
+}
+
+QString CommandName(quint32 cmd)
+{
+    const char name[4] = { char(cmd >> 24), char(cmd >> 16), char(cmd >> 8), char(cmd) };
+    return QString::fromLatin1(name, 4);
+}
+
+RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsSharedPtr &commands_v, const ImageBufferMap &image_buffers, const RenderedTimeStamps &lastRenderedTimestamps, float display_scaling, int section_id, float devicePixelRatio, CommandProfile *profile)
+{
+    QSharedPointer<QPainter> painter(rawPainter, NullDeleter());
+
+    RenderedTimeStamps rendered_timestamps;
+
+    display_scaling = display_scaling ? display_scaling : GetDisplayScaling();
+
+    QPainterPath path;
+
+    QColor fill_color(Qt::transparent);
+    int fill_gradient = -1;
+
+    QColor line_color(Qt::black);
+    float line_width = 1.0;
+    float line_dash = 0.0;
+    Qt::PenCapStyle line_cap = Qt::SquareCap;
+    Qt::PenJoinStyle line_join = Qt::BevelJoin;
+
+    QFont text_font;
+    int text_baseline = 4; // alphabetic
+    int text_align = 1; // start
+
+    float context_scaling_x = 1.0;
+    float context_scaling_y = 1.0;
+
+    QMap<int, QGradient> gradients;
+
+    auto stroke_pen = [&]() {
+        QPen pen(line_color);
+        pen.setWidthF(line_width * display_scaling);
+        pen.setJoinStyle(line_join);
+        pen.setCapStyle(line_cap);
+        if (line_dash > 0.0)
+        {
+            QVector<qreal> dashes;
+            dashes << line_dash * display_scaling << line_dash * display_scaling;
+            pen.setDashPattern(dashes);
+        }
+        return pen;
+    };
+
+    painter->fillRect(painter->viewport(), QBrush(fill_color));
+
+    QList<DrawingContextState> stack;
+
+    const quint32 *commands = commands_v->data();
+
+    QElapsedTimer profile_timer;
+    if (profile)
+        profile_timer.start();
+
+    DecodedCommands decoded;
+    DecodeBinaryCommands(*commands_v, display_scaling, decoded);
+
+    if (profile)
+    {
+        CommandTiming &timing = (*profile)[0x64636f64];  // dcod
+        timing.count += 1;
+        timing.elapsed_ns += profile_timer.nsecsElapsed();
+    }
+
+    extern QElapsedTimer timer;
+    extern qint64 timer_offset_ns;
+
+    for (const DecodedCommand &decoded_command : decoded.commands)
+    {
+        const quint32 cmd = decoded_command.cmd;
+        unsigned int command_index = decoded_command.args_index;
+
+        if (profile)
+            profile_timer.restart();
+
+        // qint64 start = qint64(timer.nsecsElapsed() / 1.0E3);
+
+        switch (cmd)
+        {
+            case 0x73617665:  // save
+            {
+                DrawingContextState values;
+                values.fill_color = fill_color;
+                values.fill_gradient = fill_gradient;
+                values.line_color = line_color;
+                values.line_width = line_width;
+                values.line_dash = line_dash;
+                values.line_cap = line_cap;
+                values.line_join = line_join;
+                values.text_font = text_font;
+                values.text_baseline = text_baseline;
+                values.text_align = text_align;
+                values.gradients = gradients;
+                values.path = path;
+                values.context_scaling_x = context_scaling_x;
+                values.context_scaling_y = context_scaling_y;
+                stack.push_back(values);
+                painter->save();
+                break;
+            }
+            case 0x72657374:  // rest, restore
+            {
+                DrawingContextState values = stack.takeLast();
+                fill_color = values.fill_color;
+                fill_gradient = values.fill_gradient;
+                line_color = values.line_color;
+                line_width = values.line_width;
+                line_dash = values.line_dash;
+                line_cap = values.line_cap;
+                line_join = values.line_join;
+                text_font = values.text_font;
+                text_baseline = values.text_baseline;
+                text_align = values.text_align;
+                gradients = values.gradients;
+                path = values.path;
+                context_scaling_x = values.context_scaling_x;
+                context_scaling_y = values.context_scaling_y;
+                painter->restore();
+                break;
+            }
+            case 0x62707468: // bpth, begin path
+            {
+                path = QPainterPath();
+                break;
+            }
+            case 0x63707468: // cpth, close path
             {
                 path.closeSubpath();
                 break;
@@ -1978,54 +2735,22 @@ RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsShare
             }
             case 0x73746174: // stat, statistics
             {
-                QString label = read_string(commands, command_index).simplified();
-
-                static QMap<QString, QElapsedTimer> timer_map;
-                static QMap<QString, QQueue<float> > times_map;
-                static QMap<QString, unsigned> count_map;
-
-                if (!timer_map.contains(label))
-                    timer_map.insert(label, QElapsedTimer());
-                if (!times_map.contains(label))
-                    times_map.insert(label, QQueue<float>());
-                if (!count_map.contains(label))
-                    count_map.insert(label, 0);
-
-                QElapsedTimer &timer = timer_map[label];
-                QQueue<float> &times = times_map[label];
-                unsigned &count = count_map[label];
-
-                if (timer.isValid())
+                QString label = decoded.strings[decoded_command.value].simplified();
+
+                // the interval between successive stat commands with the label, logged and cleared every 50
+                // intervals so that each line covers only the latest intervals.
+                const auto histogram = StatHistogram(label);
+                const int64_t time_ns = Telemetry::currentTimeNs();
+                histogram->mark(time_ns);
+                if (histogram->count() >= 50)
                 {
-                    times.enqueue(timer.elapsed() / 1000.0);
-                    while (times.length() > 50)
-                        times.dequeue();
-
-                    count += 1;
-                    if (count == 50)
-                    {
-                        float sum = 0.0;
-                        float mn = 9999.0;
-                        float mx = 0.0;
-                        Q_FOREACH(float time, times)
-                        {
-                            sum += time;
-                            mn = qMin(mn, time);
-                            mx = qMax(mx, time);
-                        }
-                        float mean = sum / times.length();
-                        float sum_of_squares = 0.0;
-                        Q_FOREACH(float time, times)
-                        {
-                            sum_of_squares += (time - mean) * (time - mean);
-                        }
-                        float std_dev = sqrt(sum_of_squares / times.length());
-                        qDebug() << label << " fps " << int(100 * (1.0 / mean)) / 100.0 << " mean " << mean << " dev " << std_dev << " min " << mn << " max " << mx;
-                        count = 0;
-                    }
+                    const auto snapshot = histogram->snapshot();
+                    const double mean = snapshot.mean() / 1.0e9;
+                    qDebug() << label << " fps " << int(100 * (1.0 / mean)) / 100.0 << " mean " << mean << " p50 " << snapshot.percentile(50) / 1.0e9 << " p99 " << snapshot.percentile(99) / 1.0e9 << " max " << snapshot.maximum / 1.0e9;
+                    // the reset clears the last mark; mark again so that the next interval starts now.
+                    histogram->reset();
+                    histogram->mark(time_ns);
                 }
-
-                timer.restart();
                 break;
             }
             case 0x696d6167: // imag, image
@@ -2049,33 +2774,40 @@ RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsShare
                 QSize destination_size((destination_rect.size() * context_scaling).toSize());
                 QSize device_destination_size = destination_size * devicePixelRatio;
 
-                QString image_key = QString::number(image_id);
+                const bool scaled = device_destination_size.width() < width * 0.75 || device_destination_size.height() < height * 0.75;
 
-                if (imageMap.contains(image_key))
+                auto image_buffer_it = image_buffers.find(image_id);
+                if (image_buffer_it != image_buffers.end())
                 {
-                    Python_ThreadBlock thread_block;
-
-                    // Put the ndarray in image
-                    PyObjectPtr ndarray_py(QVariantToPyObject(imageMap[image_key]));
-                    if (ndarray_py)
+                    const ImageKernels::ImageBuffer &image_buffer = image_buffer_it.value();
+                    if (image_buffer.isValid())
                     {
-                        // scaledImageFromRGBA is slower than using image.scaled.
-                        // image = PythonSupport::instance()->scaledImageFromRGBA(ndarray_py, destination_size);
-                        PythonSupport::instance()->imageFromRGBA(ndarray_py, &image);
+                        const ImageCache::Key cache_key{image_buffer.source, width, height, device_destination_size};
+                        const size_t content_hash = scaled ? qHashBits(image_buffer.data, size_t(image_buffer.length)) : 0;
+                        if (!scaled || !imageCache.find(cache_key, content_hash, &image.image))
+                        {
+                            QElapsedTimer conversion_timer;
+                            conversion_timer.start();
+                            if (scaled)
+                                ImageKernels::scaledImageFromRGBA(image_buffer, device_destination_size.width(), device_destination_size.height(), &image);
+                            else
+                                ImageKernels::imageFromRGBA(image_buffer, &image);
+                            if (scaled && !image.image.isNull())
+                                imageCache.insert(cache_key, content_hash, image.image);
+                            if (profile)
+                            {
+                                CommandTiming &timing = (*profile)[0x696d6763];  // imgc
+                                timing.count += 1;
+                                timing.elapsed_ns += conversion_timer.nsecsElapsed();
+                            }
+                        }
                     }
-                    // std::cout << "Using cached image" << std::endl;
                 }
                 else
-                    qDebug() << "missing " << image_key;
+                    qDebug() << "missing " << image_id;
 
                 if (!image.image.isNull())
-                {
-                    if (device_destination_size.width() < width * 0.75 || device_destination_size.height() < height * 0.75)
-                    {
-                        image.image = image.image.scaled(device_destination_size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-                    }
                     painter->drawImage(destination_rect, image.image);
-                }
 
                 break;
             }
@@ -2105,31 +2837,34 @@ RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsShare
                 QSize destination_size((destination_rect.size()* context_scaling).toSize());
                 QSize device_destination_size = destination_size * devicePixelRatio;
 
-                QString image_key = QString::number(image_id);
-
-                if (imageMap.contains(image_key))
+                auto image_buffer_it = image_buffers.find(image_id);
+                if (image_buffer_it != image_buffers.end())
                 {
-                    Python_ThreadBlock thread_block;
+                    const ImageKernels::ImageBuffer *lookup_table = nullptr;
 
-                    // Put the ndarray in image
-                    PyObjectPtr ndarray_py(QVariantToPyObject(imageMap[image_key]));
-                    if (ndarray_py)
+                    if (color_map_image_id != 0)
                     {
-                        PyObject *colormap_ndarray_py = NULL;
+                        auto color_map_it = image_buffers.find(color_map_image_id);
+                        if (color_map_it != image_buffers.end() && color_map_it.value().isValid())
+                            lookup_table = &color_map_it.value();
+                    }
 
-                        if (color_map_image_id != 0)
+                    if (image_buffer_it.value().isValid())
+                    {
+                        QElapsedTimer conversion_timer;
+                        conversion_timer.start();
+                        // the image is premultiplied ARGB32 so that drawing it does not convert it.
+                        ImageKernels::scaledImageFromArrayARGB32(image_buffer_it.value(), device_destination_size.width(), device_destination_size.height(), context_scaling, low, high, lookup_table, &image);
+                        if (profile)
                         {
-                            QString color_map_image_key = QString::number(color_map_image_id);
-                            if (imageMap.contains(color_map_image_key))
-                                colormap_ndarray_py = (PyObject *)QVariantToPyObject(imageMap[color_map_image_key]);
+                            CommandTiming &timing = (*profile)[0x64617463];  // datc
+                            timing.count += 1;
+                            timing.elapsed_ns += conversion_timer.nsecsElapsed();
                         }
-
-//                          PythonSupport::instance()->imageFromArray(ndarray_py, low, high, colormap_ndarray_py, &image);
-                        PythonSupport::instance()->scaledImageFromArray(ndarray_py, device_destination_size.width(), device_destination_size.height(), context_scaling, low, high, colormap_ndarray_py, &image);
                     }
                 }
                 else
-                    qDebug() << "missing " << image_key;
+                    qDebug() << "missing " << image_id;
 
                 if (!image.image.isNull())
                 {
@@ -2137,19 +2872,197 @@ RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsShare
                 }
                 break;
             }
+            case 0x646c696e: // dlin, data line
+            {
+                // add a line plot of the samples [first, first + count) of a one dimensional array to the path.
+                // x to x + width is divided into count equal parts and each sample is plotted at the center of its
+                // part; the values low to high span y + height to y. when there are more samples than device pixel
+                // columns, the minimum and maximum of the samples in each column are plotted at the center of the
+                // column instead, which is also the center of those samples, so the plot does not shift between the
+                // two and the cost of the path depends on the width rather than the sample count.
+                int image_id = read_uint32(commands, command_index);
+                quint32 first = read_uint32(commands, command_index);
+                quint32 count = read_uint32(commands, command_index);
+                float x = read_float(commands, command_index) * display_scaling;
+                float y = read_float(commands, command_index) * display_scaling;
+                float width = read_float(commands, command_index) * display_scaling;
+                float height = read_float(commands, command_index) * display_scaling;
+                float low = read_float(commands, command_index);
+                float high = read_float(commands, command_index);
+
+                auto image_buffer_it = image_buffers.find(image_id);
+                if (image_buffer_it != image_buffers.end() && image_buffer_it.value().data_type == ImageKernels::DataType_Unknown)
+                    qDebug() << "unsupported data type " << image_id;
+                else if (image_buffer_it != image_buffers.end() && image_buffer_it.value().isValid() && count > 0 && width > 0)
+                {
+                    const int64_t sample_count = int64_t(image_buffer_it.value().width) * image_buffer_it.value().height;
+                    count = quint32(qMax(int64_t(0), qMin(int64_t(count), sample_count - int64_t(first))));
+
+                    const long device_columns = qMax(1L, long(ceil(width * context_scaling_x * devicePixelRatio)));
+                    const bool envelope = count > quint32(device_columns) * 2;
+                    const long columns = envelope ? device_columns : long(count);
+
+                    std::vector<float> minimums(columns);
+                    std::vector<float> maximums(columns);
+                    ImageKernels::minMaxEnvelope(image_buffer_it.value(), first, count, columns, minimums.data(), maximums.data());
+
+                    const float y_scale = high != low ? height / (high - low) : 0.0f;
+                    const float y_offset = high != low ? y + high * y_scale : y + height / 2;
+
+                    // NaN values break the line.
+                    QPolygonF polygon;
+                    for (long column = 0; column < columns; ++column)
+                    {
+                        if (qIsNaN(minimums[column]))
+                        {
+                            if (!polygon.isEmpty())
+                                path.addPolygon(polygon);
+                            polygon.clear();
+                            continue;
+                        }
+                        const float y_min = y_offset - minimums[column] * y_scale;
+                        if (envelope)
+                        {
+                            // continue from the end of the previous column closest to this one.
+                            const float x_column = x + width * (column + 0.5f) / columns;
+                            const float y_max = y_offset - maximums[column] * y_scale;
+                            const bool min_first = polygon.isEmpty() || qAbs(polygon.last().y() - y_min) <= qAbs(polygon.last().y() - y_max);
+                            polygon.append(QPointF(x_column, min_first ? y_min : y_max));
+                            polygon.append(QPointF(x_column, min_first ? y_max : y_min));
+                        }
+                        else
+                        {
+                            polygon.append(QPointF(x + width * (column + 0.5f) / columns, y_min));
+                        }
+                    }
+                    if (!polygon.isEmpty())
+                        path.addPolygon(polygon);
+                }
+                else if (image_buffer_it == image_buffers.end())
+                    qDebug() << "missing " << image_id;
+                break;
+            }
+            case 0x73637472: // sctr, scatter
+            {
+                // draw a marker at each row (x, y[, size[, color index]]) of a two dimensional array. the marker shape
+                // is one of circle, square, diamond, triangle, plus, cross (0-5). without a size column, the size
+                // is given by the command. without a color index column or a color map (an array of ARGB uint32),
+                // the fill color is used. each distinct marker is rasterized once at device resolution and drawn
+                // as a sprite at the nearest device pixel, unless it is larger than MAXIMUM_MARKER_SPRITE_SIZE device
+                // pixels, in which case it is drawn directly; markers outside of the clip or with a size that is not
+                // a positive number are skipped.
+                int image_id = read_uint32(commands, command_index);
+                quint32 shape = read_uint32(commands, command_index);
+                float size = read_float(commands, command_index);
+                int color_map_image_id = read_uint32(commands, command_index);
+
+                auto image_buffer_it = image_buffers.find(image_id);
+                if (image_buffer_it != image_buffers.end() && image_buffer_it.value().data_type == ImageKernels::DataType_Unknown)
+                    qDebug() << "unsupported data type " << image_id;
+                else if (image_buffer_it != image_buffers.end() && image_buffer_it.value().isValid() && image_buffer_it.value().width >= 2)
+                {
+                    const ImageKernels::ImageBuffer &points = image_buffer_it.value();
+                    const long columns = points.width;
+                    const long point_count = points.height;
+                    std::vector<float> values(size_t(columns) * point_count);
+                    ImageKernels::readFloats(points, 0, int64_t(columns) * point_count, values.data());
+
+                    const quint32 *color_table = nullptr;
+                    long color_count = 0;
+                    auto color_map_it = color_map_image_id != 0 ? image_buffers.find(color_map_image_id) : image_buffers.end();
+                    if (color_map_it != image_buffers.end() && color_map_it.value().isValid() && (color_map_it.value().data_type == ImageKernels::DataType_UInt32 || color_map_it.value().data_type == ImageKernels::DataType_Int32))
+                    {
+                        color_table = static_cast<const quint32 *>(color_map_it.value().data);
+                        color_count = color_map_it.value().length / 4;
+                    }
+
+                    // the sprites are drawn in device pixels, without the transform.
+                    const QTransform transform = painter->transform();
+                    const qreal device_scale = sqrt(qAbs(transform.determinant()));
+                    const QRectF device_clip = painter->hasClipping() ? transform.mapRect(painter->clipBoundingRect()) : QRectF(0, 0, painter->device()->width(), painter->device()->height());
+
+                    // look up sprites locally first to avoid locking the shared cache for each marker.
+                    QHash<MarkerSpriteKey, QImage> sprites;
+
+                    painter->save();
+                    painter->resetTransform();
+                    for (long i = 0; i < point_count; ++i)
+                    {
+                        const float *point = &values[i * columns];
+                        const QPointF center = transform.map(QPointF(point[0] * display_scaling, point[1] * display_scaling));
+                        const float point_size = columns >= 3 ? point[2] : size;
+                        const qreal device_size = point_size * display_scaling * device_scale;
+                        // also rejects NaN sizes and centers.
+                        if (!qIsFinite(center.x()) || !qIsFinite(center.y()) || !qIsFinite(device_size) || !(device_size >= 0.25))
+                            continue;
+                        const qreal extent = ceil(device_size) + 2;
+                        if (!device_clip.intersects(QRectF(center.x() - extent / 2, center.y() - extent / 2, extent, extent)))
+                            continue;
+                        QRgb color = fill_color.rgba();
+                        if (columns >= 4 && color_table && color_count > 0 && !qIsNaN(point[3]))
+                            color = color_table[qMin(long(qBound(0.0f, point[3], float(color_count - 1))), color_count - 1)];
+                        if (device_size > MAXIMUM_MARKER_SPRITE_SIZE)
+                        {
+                            painter->save();
+                            painter->setRenderHint(QPainter::Antialiasing);
+                            painter->translate(center);
+                            DrawMarker(*painter, shape, device_size, QColor::fromRgba(color));
+                            painter->restore();
+                            continue;
+                        }
+                        const MarkerSpriteKey key{shape, qRound(device_size * 2), color};
+                        auto sprite_it = sprites.find(key);
+                        if (sprite_it == sprites.end())
+                            sprite_it = sprites.insert(key, markerSpriteCache.sprite(key));
+                        const QImage &sprite = sprite_it.value();
+                        painter->drawImage(QPoint(qRound(center.x() - sprite.width() / 2.0), qRound(center.y() - sprite.height() / 2.0)), sprite);
+                    }
+                    painter->restore();
+                }
+                else if (image_buffer_it == image_buffers.end())
+                    qDebug() << "missing " << image_id;
+                break;
+            }
             case 0x7374726b: // strk, stroke
             {
-                QPen pen(line_color);
-                pen.setWidthF(line_width * display_scaling);
-                pen.setJoinStyle(line_join);
-                pen.setCapStyle(line_cap);
-                if (line_dash > 0.0)
+                painter->strokePath(path, stroke_pen());
+                break;
+            }
+            case 0x706c696e:
+            case 0x70676f6e: // plin, pgon; polyline, polygon
+            {
+                // stroke a polyline with the stroke style or fill a polygon with the fill style, without
+                // using or changing the path. the points are given as a count followed by packed x, y floats.
+                quint32 point_count = read_uint32(commands, command_index);
+                QPolygonF polygon(point_count);
+                for (quint32 i = 0; i < point_count; ++i)
+                {
+                    float x = read_float(commands, command_index) * display_scaling;
+                    float y = read_float(commands, command_index) * display_scaling;
+                    polygon[i] = QPointF(x, y);
+                }
+                const QPen previous_pen = painter->pen();
+                const QBrush previous_brush = painter->brush();
+                if (cmd == 0x706c696e)
                 {
-                    QVector<qreal> dashes;
-                    dashes << line_dash * display_scaling << line_dash * display_scaling;
-                    pen.setDashPattern(dashes);
+                    QPen pen = stroke_pen();
+                    // an opaque solid line one device pixel wide is drawn with a cosmetic pen, which the raster
+                    // engine draws with its dedicated thin line stroker.
+                    const float device_line_width = line_width * display_scaling * qMin(context_scaling_x, context_scaling_y) * devicePixelRatio;
+                    if (line_color.alpha() == 255 && line_dash <= 0.0 && qAbs(device_line_width - 1.0f) < 0.01f)
+                        pen.setWidth(0);
+                    painter->setPen(pen);
+                    painter->setBrush(Qt::NoBrush);
+                    painter->drawPolyline(polygon);
                 }
-                painter->strokePath(path, pen);
+                else
+                {
+                    painter->setPen(Qt::NoPen);
+                    painter->setBrush(fill_gradient >= 0 ? QBrush(gradients[fill_gradient]) : QBrush(fill_color));
+                    painter->drawPolygon(polygon, Qt::OddEvenFill);
+                }
+                painter->setPen(previous_pen);
+                painter->setBrush(previous_brush);
                 break;
             }
             case 0x66696c6c: // fill
@@ -2160,8 +3073,7 @@ RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsShare
             }
             case 0x666c7374: // flst, fill style
             {
-                QString color_arg = read_string(commands, command_index).simplified();
-                fill_color = ParseColorString(color_arg);
+                fill_color = decoded.colors[decoded_command.value];
                 fill_gradient = -1;
                 break;
             }
@@ -2173,40 +3085,40 @@ RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsShare
             case 0x74657874:
             case 0x73747874: // text, stxt; fill text, stroke text
             {
-                QString text = read_string(commands, command_index);
+                const QString &text = decoded.strings[decoded_command.value];
                 float arg1 = read_float(commands, command_index) * display_scaling;
                 float arg2 = read_float(commands, command_index) * display_scaling;
                 read_float(commands, command_index); // max width
                 QPointF text_pos(arg1, arg2);
-                QFontMetrics fm(text_font);
-                int text_width = fm.horizontalAdvance(text);
+                const TextLayout text_layout = textLayoutCache.layout(text, text_font, painter->transform(), cmd != 0x74657874);
+                int text_width = text_layout.advance;
                 if (text_align == 2 || text_align == 5) // end or right
                     text_pos.setX(text_pos.x() - text_width);
                 else if (text_align == 4) // center
                     text_pos.setX(text_pos.x() - text_width * 0.5);
                 if (text_baseline == 1)    // top
-                    text_pos.setY(text_pos.y() + fm.ascent());
+                    text_pos.setY(text_pos.y() + text_layout.ascent);
                 else if (text_baseline == 2)    // hanging
-                    text_pos.setY(text_pos.y() + 2 * fm.ascent() - fm.height());
+                    text_pos.setY(text_pos.y() + 2 * text_layout.ascent - text_layout.height);
                 else if (text_baseline == 3)    // middle
-                    text_pos.setY(text_pos.y() + fm.xHeight() * 0.5);
+                    text_pos.setY(text_pos.y() + text_layout.x_height * 0.5);
                 else if (text_baseline == 4 || text_baseline == 5)  // alphabetic or ideographic
                     text_pos.setY(text_pos.y());
                 else if (text_baseline == 5)    // bottom
-                    text_pos.setY(text_pos.y() + fm.ascent() - fm.height());
+                    text_pos.setY(text_pos.y() + text_layout.ascent - text_layout.height);
                 if (cmd == 0x74657874) // text, fill text
                 {
                     QBrush brush = fill_gradient >= 0 ? QBrush(gradients[fill_gradient]) : QBrush(fill_color);
                     painter->save();
                     painter->setFont(text_font);
                     painter->setPen(QPen(brush, 1.0 * display_scaling));
-                    painter->drawText(text_pos, text);
+                    // static text is positioned by its top left rather than its baseline.
+                    painter->drawStaticText(text_pos - QPointF(0, text_layout.ascent), text_layout.static_text);
                     painter->restore();
                 }
                 else // stroke text
                 {
-                    QPainterPath path;
-                    path.addText(text_pos, text_font, text);
+                    const QPainterPath path = text_layout.path->translated(text_pos);
                     QPen pen(line_color);
                     pen.setWidth(line_width * display_scaling);
                     pen.setJoinStyle(line_join);
@@ -2217,47 +3129,24 @@ RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsShare
             }
             case 0x666f6e74: // font
             {
-                QString font_str = read_string(commands, command_index);
-                text_font = ParseFontString(font_str, display_scaling);
+                text_font = decoded.fonts[decoded_command.value];
                 break;
             }
             case 0x616c676e: // algn, text align
             {
-                QString arg0 = read_string(commands, command_index);
-                if (arg0 == "start")
-                    text_align = 1;
-                if (arg0 == "end")
-                    text_align = 2;
-                if (arg0 == "left")
-                    text_align = 3;
-                if (arg0 == "center")
-                    text_align = 4;
-                if (arg0 == "right")
-                    text_align = 5;
+                if (decoded_command.value >= 0)
+                    text_align = decoded_command.value;
                 break;
             }
             case 0x74626173: // tbas, textBaseline
             {
-                QString arg0 = read_string(commands, command_index);
-                if (arg0 == "top")
-                    text_baseline = 1;
-                if (arg0 == "hanging")
-                    text_baseline = 2;
-                if (arg0 == "middle")
-                    text_baseline = 3;
-                if (arg0 == "alphabetic")
-                    text_baseline = 4;
-                if (arg0 == "ideographic")
-                    text_baseline = 5;
-                if (arg0 == "bottom")
-                    text_baseline = 6;
+                if (decoded_command.value >= 0)
+                    text_baseline = decoded_command.value;
                 break;
             }
             case 0x73747374: // stst, strokeStyle
             {
-                QString arg0 = read_string(commands, command_index);
-                QString color_arg = arg0.simplified();
-                line_color = ParseColorString(color_arg);
+                line_color = decoded.colors[decoded_command.value];
                 break;
             }
             case 0x6c647368: // ldsh, line dash
@@ -2272,24 +3161,14 @@ RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsShare
             }
             case 0x6c636170: // lcap, lineCap
             {
-                QString arg0 = read_string(commands, command_index);
-                if (arg0 == "square")
-                    line_cap = Qt::SquareCap;
-                if (arg0 == "round")
-                    line_cap = Qt::RoundCap;
-                if (arg0 == "butt")
-                    line_cap = Qt::FlatCap;
+                if (decoded_command.value >= 0)
+                    line_cap = Qt::PenCapStyle(decoded_command.value);
                 break;
             }
             case 0x6c6e6a6e: // lnjn, lineJoin
             {
-                QString arg0 = read_string(commands, command_index);
-                if (arg0 == "round")
-                    line_join = Qt::RoundJoin;
-                if (arg0 == "miter")
-                    line_join = Qt::MiterJoin;
-                if (arg0 == "bevel")
-                    line_join = Qt::BevelJoin;
+                if (decoded_command.value >= 0)
+                    line_join = Qt::PenJoinStyle(decoded_command.value);
                 break;
             }
             case 0x67726164: // grad, gradient
@@ -2308,8 +3187,7 @@ RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsShare
             {
                 int arg0 = read_uint32(commands, command_index);
                 float arg1 = read_float(commands, command_index);
-                QString arg2 = read_string(commands, command_index);
-                gradients[arg0].setColorAt(arg1, QColor(arg2));
+                gradients[arg0].setColorAt(arg1, decoded.colors[decoded_command.value]);
                 break;
             }
             case 0x736c6570: // slep, sleep
@@ -2326,12 +3204,12 @@ RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsShare
             }
             case 0x6d657367: // mesg, message
             {
-                qDebug() << read_string(commands, command_index);
+                qDebug() << decoded.strings[decoded_command.value];
                 break;
             }
             case 0x74696d65: // time, message
             {
-                QString text = read_string(commands, command_index);
+                QString text = decoded.strings[decoded_command.value];
                 int64_t timestamp_ns = 0;
                 int64_t elapsed_ns = 0;
                 if (text.length() > 4)
@@ -2357,44 +3235,93 @@ RenderedTimeStamps PaintBinaryCommands(QPainter *rawPainter, const CommandsShare
             }
         }
 
+        // the decoder skips the numeric arguments of each command by BinaryCommandArgumentCount.
+        Q_ASSERT(cmd == 0x74657874 || cmd == 0x73747874 || cmd == 0x706c696e || cmd == 0x70676f6e ||
+                 command_index - decoded_command.args_index == BinaryCommandArgumentCount(cmd));
+
         // qint64 end = qint64(timer.nsecsElapsed() / 1.0E3);
         // if (end - start > 50)
         //     qDebug() << "cmd " << QString::number(cmd, 16) << " " << (end - start);
+
+        if (profile)
+        {
+            CommandTiming &timing = (*profile)[cmd];
+            timing.count += 1;
+            timing.elapsed_ns += profile_timer.nsecsElapsed();
+        }
     }
 
     return rendered_timestamps;
 }
 
-PyCanvasRenderTask::PyCanvasRenderTask(PyCanvas *canvas, const CanvasSectionSharedPtr &section, const DrawingCommandsSharedPtr &drawing_commands, float devicePixelRatio, const RenderedTimeStamps &rendered_timestamps)
+PyCanvasRenderTask::PyCanvasRenderTask(PyCanvas *canvas, const CanvasSectionSharedPtr &section, const DrawingCommandsSharedPtr &drawing_commands, float devicePixelRatio, const CanvasSectionImageSharedPtr &previous_image)
     : m_canvas(canvas)
     , m_section(section)
     , m_drawing_commands(drawing_commands)
     , m_device_pixel_ratio(devicePixelRatio)
-    , m_rendered_timestamps(rendered_timestamps)
+    , m_previous_image(previous_image)
+    , m_created_ns(Telemetry::currentTimeNs())
 {
     // NOTE: this class is a QRunnable and auto deletes when the run() method completes.
 }
 
 void PyCanvasRenderTask::run()
 {
+    const int64_t start_ns = Telemetry::currentTimeNs();
+    m_section->m_queue_wait->record(start_ns - m_created_ns);
+
     RenderResult render_result(m_section);
 
     auto const commands = m_drawing_commands->commands();
     auto const rect = m_drawing_commands->rect();
-    auto const image_map = m_drawing_commands->imageMap();
+    auto const image_buffers = m_drawing_commands->imageBuffers();
 
     if (commands && !commands->empty() && !rect.isEmpty())
     {
+        const bool profiling = canvasProfiler.isEnabled();
+        CommandProfile profile;
+        QElapsedTimer render_timer;
+        if (profiling)
+            render_timer.start();
+
         // create the buffer image at a resolution suitable for the devicePixelRatio of the section's screen.
-        QSharedPointer<QImage> image = QSharedPointer<QImage>(new QImage(QSize(rect.width() * m_device_pixel_ratio, rect.height() * m_device_pixel_ratio), QImage::Format_ARGB32_Premultiplied));
-        image->fill(QColor(0,0,0,0));
-        QPainter painter(image.data());
+        const QSize image_size(rect.width() * m_device_pixel_ratio, rect.height() * m_device_pixel_ratio);
+        // if only part of the section changed and the previous image has the same geometry, only repaint
+        // the dirty rect of a copy of the previous image. the dirty rect is aligned to device pixels. the
+        // image is rendered into a back buffer that is recycled once it is no longer painted.
+        const QRect dirty_rect = m_drawing_commands->dirtyRect();
+        const QSharedPointer<QImage> previous_image = m_previous_image ? m_previous_image->image : QSharedPointer<QImage>();
+        const bool partial = !dirty_rect.isEmpty() && previous_image && m_previous_image->image_rect == rect && previous_image->size() == image_size;
+        QImage back_buffer = m_section->acquireBackBuffer(image_size);
+        // the previous image was rendered by this task's section in the same format and size.
+        if (partial)
+            memcpy(back_buffer.bits(), previous_image->constBits(), back_buffer.sizeInBytes());
+        else
+            back_buffer.fill(QColor(0,0,0,0));
+        QPainter painter(&back_buffer);
         painter.setRenderHints(DEFAULT_RENDER_HINTS);
+        if (partial)
+        {
+            const QRect device_dirty_rect = QRectF(QPointF(dirty_rect.topLeft()) * m_device_pixel_ratio, QSizeF(dirty_rect.size()) * m_device_pixel_ratio).toAlignedRect() & back_buffer.rect();
+            painter.setCompositionMode(QPainter::CompositionMode_Source);
+            painter.fillRect(device_dirty_rect, Qt::transparent);
+            painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+            painter.setClipRect(device_dirty_rect);
+        }
         // draw everything at the higher scale of the section's screen.
         painter.scale(m_device_pixel_ratio, m_device_pixel_ratio);
-        auto new_rendered_timestamps = PaintBinaryCommands(&painter, commands, image_map, m_rendered_timestamps, 0.0, m_section->m_section_id, m_device_pixel_ratio);
+        const RenderedTimeStamps rendered_timestamps = m_previous_image ? m_previous_image->paintedTimeStamps() : RenderedTimeStamps();
+        auto new_rendered_timestamps = PaintBinaryCommands(&painter, commands, image_buffers, rendered_timestamps, 0.0, m_section->m_section_id, m_device_pixel_ratio, profiling ? &profile : nullptr);
         painter.end();  // ending painter here speeds up QImage assignment below (Windows)
-        render_result.image = image;
+        if (profiling)
+        {
+            CommandTiming &timing = profile[0x726e6472];  // rndr
+            timing.count += 1;
+            timing.elapsed_ns += render_timer.nsecsElapsed();
+            canvasProfiler.add(m_section->m_section_id, profile);
+        }
+        m_section->releaseBackBuffer(back_buffer);
+        render_result.image = QSharedPointer<QImage>(new QImage(back_buffer));
         render_result.image_rect = rect;
         for (auto const &r : new_rendered_timestamps)
         {
@@ -2406,19 +3333,69 @@ void PyCanvasRenderTask::run()
         render_result.record_latency = true;
     }
 
+    m_section->m_render_time->record(Telemetry::currentTimeNs() - start_ns);
+
     m_canvas->continuePaintingSection(render_result);
 }
 
-CanvasSection::CanvasSection(int section_id, float device_pixel_ratio)
+RenderedTimeStamps CanvasSectionImage::paintedTimeStamps() const
+{
+    RenderedTimeStamps painted_timestamps(rendered_timestamps);
+    const int64_t first_painted_ns = painted_ns.load();
+    if (first_painted_ns)
+    {
+        for (auto &painted_timestamp : painted_timestamps)
+            painted_timestamp.elapsed_ns = first_painted_ns - painted_timestamp.timestamp_ns;
+    }
+    return painted_timestamps;
+}
+
+CanvasSection::CanvasSection(int section_id, float device_pixel_ratio, const QString &telemetry_prefix)
     : m_section_id(section_id)
     , m_device_pixel_ratio(device_pixel_ratio)
-    , record_latency(false)
     , m_render_task(nullptr)
     , closing(false)
+    , m_telemetry_prefix(telemetry_prefix)
+    , m_render_time(Telemetry::histogram(telemetry_prefix + ".render"))
+    , m_queue_wait(Telemetry::histogram(telemetry_prefix + ".queue_wait"))
+    , m_latency(Telemetry::histogram(telemetry_prefix + ".latency"))
+    , m_frame_interval(Telemetry::histogram(telemetry_prefix + ".frame_interval"))
 {
     // m_render_task auto deletes after its run method finishes, so it should not be in a scoped or shared pointer.
 }
 
+// the back buffers kept per section: one being rendered, one published, and one that may still be painted.
+static const int BACK_BUFFER_COUNT = 3;
+
+QImage CanvasSection::acquireBackBuffer(const QSize &size)
+{
+    // a pooled back buffer is free when the pool holds the only reference to its pixels, i.e. once
+    // the section images and paint events that shared it have been released.
+    for (int i = 0; i < m_back_buffers.size(); ++i)
+    {
+        if (m_back_buffers[i].size() == size && m_back_buffers[i].isDetached())
+        {
+            // pair with the release of the last other reference before writing the pixels.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            back_buffer_hits.fetch_add(1, std::memory_order_relaxed);
+            return m_back_buffers.takeAt(i);
+        }
+    }
+
+    // free back buffers of another size will not be used again.
+    m_back_buffers.removeIf([size](const QImage &back_buffer) { return back_buffer.size() != size && back_buffer.isDetached(); });
+
+    back_buffer_misses.fetch_add(1, std::memory_order_relaxed);
+    return QImage(size, QImage::Format_ARGB32_Premultiplied);
+}
+
+void CanvasSection::releaseBackBuffer(const QImage &back_buffer)
+{
+    m_back_buffers.append(back_buffer);
+    while (m_back_buffers.size() > BACK_BUFFER_COUNT)
+        m_back_buffers.removeFirst();
+}
+
 /*
  The canvas widget renders low-level drawing commnds in a thread and paints the resulting bitmap.
 
@@ -2433,35 +3410,60 @@ CanvasSection::CanvasSection(int section_id, float device_pixel_ratio)
  are pending drawing commands received during an existing rendering. If multiple drawing commands are submitted
  during rendering, only the latest one is used as the pending drawing commands.
 
- When a section has finished rendering, it requests the document window to update the section's canvas item.
- The request is thread safe and does not block. The next rendering pass for the section can begin immediately.
- The document window checks periodically for update requests in timerEvent on the main thread. If it sees a
- request, it calls update on the target canvas item in order to trigger a paint event. If multiple sections
- request updates in between paint events, update will only be called once per canvas item. The paint event
- draws all sections. Calling update or receiving a paint event is always done on the main thread. For best
- performance, the paint event must run quickly and update must not be called too often, otherwise Qt will try
- to gather up repaint events by delaying them.
+ When a section has finished rendering, it requests a repaint of the canvas (requestRepaint). The request is
+ thread safe and does not block. The next rendering pass for the section can begin immediately. The request is
+ queued to the main thread, where it calls update on the canvas in order to trigger a paint event. Requests are
+ coalesced: only one request is queued at a time, and update is called at most once per refresh interval of the
+ canvas's screen; a request within the interval is deferred to its end. The paint event draws all sections.
+ Calling update or receiving a paint event is always done on the main thread. For best performance, the paint
+ event must run quickly and update must not be called too often, otherwise Qt will try to gather up repaint
+ events by delaying them.
+
+ Sections outside of the visible rect of the canvas are not rendered. The visible rect is empty when the canvas
+ is hidden, for instance in a hidden tab or a collapsed dock, and is clipped by ancestors such as a scroll area
+ viewport. The latest drawing commands of a section that is not visible are kept as pending and rendered once
+ the section becomes visible (setVisibleRect).
 
  To achieve high performance, locking is minimized (see m_sections_mutex). The lock is held in the destructor
  for synchronization, when updating the section with the bitmap after it has been rendered on its
- thread (continuePaintingSection), during painting (paintEvent), and when updating the commands to trigger
- rendering on a thread (setBinarySectionCommands).
+ thread (continuePaintingSection), when removing a section, when updating the commands to trigger
+ rendering on a thread (setBinarySectionCommands), and when the visible rect changes (setVisibleRect).
+
+ The paint event does not take the lock. Whenever a section bitmap changes, the bitmaps of all sections are
+ published as a new immutable map (m_section_images) which replaces the previous one atomically. The paint
+ event paints the map current at the time it starts.
+
+ The render time, queue wait, paint time, latency and frame interval are recorded in telemetry histograms named
+ canvas.<canvas>.paint and canvas.<canvas>.section.<section>.<metric>, which are lock-free and may be recorded
+ from any thread. The optional latency display reads them. They are removed with the section or canvas.
  */
 
 PyCanvas::PyCanvas()
     : m_closing(false)
+    , m_visible_rect_update_queued(false)
     , m_pressed(false)
     , m_grab_mouse_count(0)
+    , m_repaint_requested(false)
 {
+    static std::atomic<int> telemetry_serial_number{0};
+    m_telemetry_prefix = "canvas." + QString::number(++telemetry_serial_number);
+    m_paint_time = Telemetry::histogram(m_telemetry_prefix + ".paint");
+
     setMouseTracking(true);
     setAcceptDrops(true);
+
+    m_repaint_timer.setSingleShot(true);
+    m_repaint_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_repaint_timer, &QTimer::timeout, this, [this]() {
+        m_last_repaint_timer.start();
+        update();
+    });
 }
 
 PyCanvas::~PyCanvas()
 {
     m_closing = true;
-    // cancel any outstanding requests before shutting down the thread.
-    repaintManager.cancelRepaintRequest(this);
+    // repaint requests queued to this canvas are discarded when it is destroyed.
     // now shut down the rendering thread by waiting until not rendering.
     QMutexLocker locker(&m_sections_mutex);
     while (true)
@@ -2481,9 +3483,38 @@ PyCanvas::~PyCanvas()
         QThread::msleep(1);
         m_sections_mutex.lock();
     }
-    // and once again cancel outstanding requests that might have been added
-    // during thread shutdown.
-    repaintManager.cancelRepaintRequest(this);
+    Telemetry::removeHistograms(m_telemetry_prefix + ".");
+}
+
+void PyCanvas::requestRepaint()
+{
+    // only queue one request at a time; it is cleared when the request is handled.
+    if (!m_repaint_requested.exchange(true))
+        QMetaObject::invokeMethod(this, [this]() { scheduleRepaint(); }, Qt::QueuedConnection);
+}
+
+void PyCanvas::scheduleRepaint()
+{
+    m_repaint_requested.store(false);
+
+    // an update is already scheduled for the end of the current refresh interval.
+    if (m_repaint_timer.isActive())
+        return;
+
+    auto screen = this->screen();
+    const qreal refresh_rate = screen && screen->refreshRate() > 0 ? screen->refreshRate() : 60.0;
+    const qint64 refresh_interval_ns = qint64(1.0E9 / refresh_rate);
+    const qint64 elapsed_ns = m_last_repaint_timer.isValid() ? m_last_repaint_timer.nsecsElapsed() : refresh_interval_ns;
+
+    if (elapsed_ns >= refresh_interval_ns)
+    {
+        m_last_repaint_timer.start();
+        update();
+    }
+    else
+    {
+        m_repaint_timer.start(int((refresh_interval_ns - elapsed_ns + 999999) / 1000000));
+    }
 }
 
 /*
@@ -2507,21 +3538,37 @@ void PyCanvas::continuePaintingSection(const RenderResult &render_result)
         // is being called from the run method, deleting the m_render_task here would be an error and
         // lead to crashes.
         section->m_render_task = nullptr;
-        section->m_rendered_timestamps = render_result.rendered_timestamps;
-        section->image = render_result.image;
-        section->image_rect = render_result.image_rect;
-        section->record_latency = render_result.record_latency;
+        if (render_result.image)
+        {
+            auto section_image = std::make_shared<CanvasSectionImage>();
+            section_image->image = render_result.image;
+            section_image->image_rect = render_result.image_rect;
+            section_image->rendered_timestamps = render_result.rendered_timestamps;
+            section_image->record_latency = render_result.record_latency;
+            section_image->latency = section->m_latency;
+            section_image->frame_interval = section->m_frame_interval;
+            section->m_image = section_image;
+        }
+        else
+        {
+            section->m_image.reset();
+        }
+        if (!section->closing)
+            publishSectionImages();
         auto pending_commands = section->m_pending_drawing_commands;
-        section->m_pending_drawing_commands.reset();
+        // leave the pending commands of a section that is not visible to be rendered when it becomes visible.
+        const bool deferred = pending_commands && !isRectVisible(pending_commands->rect());
+        if (!deferred)
+            section->m_pending_drawing_commands.reset();
         // do not start a new task if closing.
-        if (!m_closing && !section->closing && pending_commands)
+        if (!m_closing && !section->closing && pending_commands && !deferred)
         {
-            task = new PyCanvasRenderTask(this, section, pending_commands, section->m_device_pixel_ratio, section->m_rendered_timestamps);
+            task = new PyCanvasRenderTask(this, section, pending_commands, section->m_device_pixel_ratio, section->m_image);
             section->m_render_task = task;
         }
         // note: this may be occurring during a delete, in which case even the window may not be available.
         if (!m_closing && !section->closing)
-            repaintManager.requestRepaint(this);
+            requestRepaint();
     }
 
     // launch the task outside of the mutex.
@@ -2529,6 +3576,95 @@ void PyCanvas::continuePaintingSection(const RenderResult &render_result)
         QThreadPool::globalInstance()->start(task);
 }
 
+bool PyCanvas::isRectVisible(const QRect &rect) const
+{
+    // empty drawing commands are rendered regardless, to clear the section.
+    return rect.isEmpty() || rect.intersects(m_visible_rect);
+}
+
+void PyCanvas::updateVisibleRect()
+{
+    m_visible_rect_update_queued = false;
+
+    // the visible region is empty when the canvas or an ancestor is hidden and is clipped by the ancestors.
+    setVisibleRect(visibleRegion().boundingRect());
+}
+
+/*
+ Update the visible rect of the canvas and render the pending commands of the sections that became visible.
+
+ Called on the main thread.
+ */
+void PyCanvas::setVisibleRect(const QRect &visible_rect)
+{
+    // m_visible_rect is only written on the main thread, so it can be compared without the lock.
+    if (visible_rect == m_visible_rect)
+        return;
+
+    QList<PyCanvasRenderTask *> tasks;
+
+    {
+        QMutexLocker locker(&m_sections_mutex);
+
+        m_visible_rect = visible_rect;
+
+        if (!m_closing)
+        {
+            for (auto const &section : m_sections)
+            {
+                auto pending_commands = section->m_pending_drawing_commands;
+                if (!section->m_render_task && !section->closing && pending_commands && isRectVisible(pending_commands->rect()))
+                {
+                    auto task = new PyCanvasRenderTask(this, section, pending_commands, section->m_device_pixel_ratio, section->m_image);
+                    section->m_render_task = task;
+                    section->m_pending_drawing_commands.reset();
+                    tasks.append(task);
+                }
+            }
+        }
+    }
+
+    // launch the tasks outside of the mutex.
+    for (auto task : tasks)
+        QThreadPool::globalInstance()->start(task);
+}
+
+void PyCanvas::showEvent(QShowEvent *event)
+{
+    QWidget::showEvent(event);
+    updateVisibleRect();
+}
+
+void PyCanvas::hideEvent(QHideEvent *event)
+{
+    QWidget::hideEvent(event);
+    setVisibleRect(QRect());
+}
+
+void PyCanvas::moveEvent(QMoveEvent *event)
+{
+    // scrolling a scroll area moves the canvas within the viewport.
+    QWidget::moveEvent(event);
+    updateVisibleRect();
+}
+
+/*
+ Publish the current bitmaps of the sections to the paint event.
+
+ Must be called with m_sections_mutex held, which serializes the publishers. The paint event reads the
+ published map without locking.
+ */
+void PyCanvas::publishSectionImages()
+{
+    auto section_images = std::make_shared<CanvasSectionImages>();
+    for (auto const &section : m_sections)
+    {
+        if (section->m_image && !section->closing)
+            section_images->insert(section->m_section_id, section->m_image);
+    }
+    std::atomic_store(&m_section_images, std::shared_ptr<const CanvasSectionImages>(section_images));
+}
+
 void PyCanvas::focusInEvent(QFocusEvent *event)
 {
     Q_UNUSED(event)
@@ -2567,73 +3703,26 @@ int64_t GetCurrentTime()
 #if defined(__linux__)
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
-    return static_cast<int64_t>(ts.tv_nsec);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
 #endif
 }
 
-template<typename T>
-struct Measurements
+// the mean and percentiles (p50/p90/p99) of the latencies in milliseconds.
+static QString LatencyText(const Telemetry::HistogramSnapshot &latency)
 {
-    Measurements(const QQueue<T> &values_in)
-        : minimum(std::numeric_limits<T>::max())
-        , maximum(std::numeric_limits<T>::min())
-        , average(0.0)
-        , std_dev(0.0)
-    {
-        auto values = values_in;
-        std::sort(values.begin(), values.end());
-        int discard = values.size() / 10;
-        while (discard > 0)
-        {
-            if (discard > 0 && values.size())
-            {
-                values.pop_front();
-                discard -= 1;
-            }
-            if (discard > 0 && values.size())
-            {
-                values.pop_back();
-                discard -= 1;
-            }
-        }
-        for (auto value : values)
-        {
-            average += value;
-            if (value < minimum)
-                minimum = value;
-            if (value > maximum)
-                maximum = value;
-        }
-        average = average / values.size();
-        double sum_squares = 0;
-        for (auto value : values)
-        {
-            sum_squares += (value - average) * (value - average);
-            value_string_list += " " + QString::number(qRound(value / 1e6));
-        }
-        std_dev = sqrt(sum_squares / values.size());
-    }
-
-    T minimum;
-    T maximum;
-    double average;
-    double std_dev;
-    QString value_string_list;
-
-    QString text() const
-    {
-        if (average > 0)
-            return " " + QString::number(qRound(average / 1e6)).rightJustified(3) + " ± " + QString::number(std_dev / 1e6, 'f', 1).rightJustified(4) + " [" + QString::number(qRound(minimum / 1e6)).rightJustified(3) + ":" + QString::number(qRound(maximum / 1e6)).rightJustified(3) + " ] ";
-        return QString();
-    }
+    if (latency.count > 0)
+        return " " + QString::number(qRound(latency.mean() / 1e6)).rightJustified(3) + " [" + QString::number(qRound(latency.percentile(50) / 1e6)).rightJustified(3) + "/" + QString::number(qRound(latency.percentile(90) / 1e6)).rightJustified(3) + "/" + QString::number(qRound(latency.percentile(99) / 1e6)).rightJustified(3) + " ] ";
+    return QString();
+}
 
-    QString textF() const
-    {
-        if (average > 0.0)
-            return " " + QString::number(average, 'f', 1).rightJustified(3) + " ± " + QString::number(std_dev, 'f', 1).rightJustified(4) + " [" + QString::number(minimum, 'f', 1).rightJustified(3) + ":" + QString::number(maximum, 'f', 1).rightJustified(3) + " ] ";
-        return QString();
-    }
-};
+// the frame rate of the mean frame interval and of the p50/p99 frame intervals.
+static QString FrameRateText(const Telemetry::HistogramSnapshot &frame_interval)
+{
+    auto frame_rate = [](double interval_ns) { return interval_ns > 0.0 ? 1.0e9 / interval_ns : 0.0; };
+    if (frame_interval.count > 0)
+        return " " + QString::number(frame_rate(frame_interval.mean()), 'f', 1).rightJustified(5) + " [" + QString::number(frame_rate(frame_interval.percentile(50)), 'f', 1).rightJustified(5) + "/" + QString::number(frame_rate(frame_interval.percentile(99)), 'f', 1).rightJustified(5) + " ] ";
+    return QString();
+}
 
 struct ImageAndRect
 {
@@ -2663,66 +3752,58 @@ void PyCanvas::paintEvent(QPaintEvent *event)
 {
     Q_UNUSED(event)
 
+    const int64_t paint_start_ns = Telemetry::currentTimeNs();
+
     std::list<ImageAndRect> imageAndRects;
     std::list<DrawnText> drawnTexts;
 
-    RenderedTimeStamps rendered_timestamps;
-
+    // a paint event may expose part of the canvas that was clipped, for instance by a resized viewport. the
+    // visible rect is updated after the paint, since it locks the sections and may start render tasks.
+    if (!m_visible_rect.contains(event->rect()) && !m_visible_rect_update_queued)
     {
-        QMutexLocker locker(&m_sections_mutex);
+        m_visible_rect_update_queued = true;
+        QMetaObject::invokeMethod(this, [this]() { updateVisibleRect(); }, Qt::QueuedConnection);
+    }
 
+    // the section images are replaced atomically by the render threads, so paint without locking.
+    const auto section_images = std::atomic_load(&m_section_images);
+
+    if (section_images)
+    {
         auto current_time_ns = GetCurrentTime();
 
-        for (auto const &section : m_sections)
+        for (auto iter = section_images->constBegin(); iter != section_images->constEnd(); ++iter)
         {
-            if (section->image && !section->image->isNull() && section->image_rect.intersects(event->rect()))
-                imageAndRects.push_back(ImageAndRect(section->image, section->image_rect));
+            const auto &section_image = iter.value();
 
-            for (auto &rendered_timestamp : section->m_rendered_timestamps)
-            {
-                if (!rendered_timestamp.elapsed_ns)
-                {
-                    rendered_timestamp.elapsed_ns = current_time_ns - rendered_timestamp.timestamp_ns;
-                }
-            }
-            rendered_timestamps.append(section->m_rendered_timestamps);
-        }
+            if (section_image->image && !section_image->image->isNull() && section_image->image_rect.intersects(event->rect()))
+                imageAndRects.push_back(ImageAndRect(section_image->image, section_image->image_rect));
 
-        for (auto const &rendered_timestamp : rendered_timestamps)
-        {
-            if (rendered_timestamp.section_id > 0)
+            // the first paint of the image determines its latency.
+            int64_t painted_ns = 0;
+            const bool first_paint = section_image->painted_ns.compare_exchange_strong(painted_ns, current_time_ns);
+            if (first_paint)
+                painted_ns = current_time_ns;
+            bool record_latency = first_paint && section_image->record_latency;
+
+            for (auto const &rendered_timestamp : section_image->rendered_timestamps)
             {
-                auto section = m_sections[rendered_timestamp.section_id];
-                if (section->record_latency)
+                if (rendered_timestamp.section_id > 0 && section_image->latency && section_image->frame_interval)
                 {
-                    section->latencies_ns.enqueue(rendered_timestamp.elapsed_ns);
-                    while (section->latencies_ns.size() > 40)
-                        section->latencies_ns.dequeue();
-                    section->timestamps_ns.enqueue(rendered_timestamp.timestamp_ns);
-                    while (section->timestamps_ns.size() > 40)
-                        section->timestamps_ns.dequeue();
-                    section->record_latency = false;
-                }
-                QQueue<double> frame_rates;
-                auto timestamps_ns(section->timestamps_ns);
-                if (timestamps_ns.size() > 1)
-                {
-                    for (auto i = 0; i < timestamps_ns.size() - 1; ++i)
+                    const int64_t elapsed_ns = painted_ns - rendered_timestamp.timestamp_ns;
+                    if (record_latency)
                     {
-                        auto delta_ns = timestamps_ns[i+1] - timestamps_ns[i];
-                        if (delta_ns > 0.0)
-                        {
-                            double frame_rate = 1.0e9 / delta_ns;
-                            frame_rates.push_back(frame_rate);
-                        }
+                        section_image->latency->record(elapsed_ns);
+                        section_image->frame_interval->mark(rendered_timestamp.timestamp_ns);
+                        record_latency = false;
                     }
+                    const auto latency = section_image->latency->snapshot();
+                    const auto frame_interval = section_image->frame_interval->snapshot();
+                    QString latency_text = "Latency " + QString::number(static_cast<int>(qRound(elapsed_ns / 1e6))).rightJustified(4) + LatencyText(latency);
+                    QString frame_rate_text = "Frame Rate" + FrameRateText(frame_interval);
+                    drawnTexts.push_back(DrawnText(frame_rate_text, 0, rendered_timestamp.transform));
+                    drawnTexts.push_back(DrawnText(latency_text, 1, rendered_timestamp.transform));
                 }
-                Measurements latencies_measurement(section->latencies_ns);
-                Measurements frame_rates_measurement(frame_rates);
-                QString latency_text = "Latency " + QString::number(static_cast<int>(qRound(rendered_timestamp.elapsed_ns / 1e6))).rightJustified(4) + latencies_measurement.text();
-                QString frame_rate_text = "Frame Rate" + frame_rates_measurement.textF();
-                drawnTexts.push_back(DrawnText(frame_rate_text, 0, rendered_timestamp.transform));
-                drawnTexts.push_back(DrawnText(latency_text, 1, rendered_timestamp.transform));
             }
         }
     }
@@ -2754,6 +3835,10 @@ void PyCanvas::paintEvent(QPaintEvent *event)
         painter.fillPath(path, Qt::black);
         painter.restore();
     }
+
+    painter.end();
+
+    m_paint_time->record(Telemetry::currentTimeNs() - paint_start_ns);
 }
 
 bool PyCanvas::event(QEvent *event)
@@ -2907,6 +3992,7 @@ void PyCanvas::wheelEvent(QWheelEvent *event)
 void PyCanvas::resizeEvent(QResizeEvent *event)
 {
     QWidget::resizeEvent(event);
+    updateVisibleRect();
     if (m_py_object.isValid())
     {
         float display_scaling = GetDisplayScaling();
@@ -3029,19 +4115,25 @@ void PyCanvas::setBinarySectionCommands(int section_id, const DrawingCommandsSha
             {
                 auto screen = this->screen();
                 auto device_pixel_ratio = screen ? screen->devicePixelRatio() : 1.0;  // m_screen may be nullptr in earlier versions of Qt
-                section.reset(new CanvasSection(section_id, device_pixel_ratio));
+                section.reset(new CanvasSection(section_id, device_pixel_ratio, m_telemetry_prefix + ".section." + QString::number(section_id)));
                 m_sections[section_id] = section;
             }
 
             pending_drawing_commands = section->m_pending_drawing_commands;
 
-            if (!section->m_render_task && !section->closing)
+            // the pending commands are replaced; include the changes they would have painted.
+            if (pending_drawing_commands)
+                drawing_commands->includeDirtyRect(pending_drawing_commands->dirtyRect());
+
+            if (!section->m_render_task && !section->closing && isRectVisible(drawing_commands->rect()))
             {
-                task = new PyCanvasRenderTask(this, section, drawing_commands, section->m_device_pixel_ratio, section->m_rendered_timestamps);
+                task = new PyCanvasRenderTask(this, section, drawing_commands, section->m_device_pixel_ratio, section->m_image);
                 section->m_render_task = task;
+                section->m_pending_drawing_commands.reset();
             }
             else
             {
+                // rendering is busy or the section is not visible (see setVisibleRect).
                 section->m_pending_drawing_commands = drawing_commands;
             }
         }
@@ -3075,6 +4167,10 @@ void PyCanvas::removeSection(int section_id)
     }
 
     m_sections.remove(section_id);
+
+    Telemetry::removeHistograms(section->m_telemetry_prefix + ".");
+
+    publishSectionImages();
 }
 
 void PyCanvas::dragEnterEvent(QDragEnterEvent *event)
@@ -5,6 +5,8 @@
 #ifndef DOCUMENT_WINDOW_H
 #define DOCUMENT_WINDOW_H
 
+#include <atomic>
+
 #include <QtCore/QAbstractListModel>
 #include <QtCore/QDateTime>
 #include <QtCore/QElapsedTimer>
@@ -12,6 +14,7 @@
 #include <QtCore/QQueue>
 #include <QtCore/QRunnable>
 #include <QtCore/QThread>
+#include <QtCore/QTimer>
 #include <QtCore/QWaitCondition>
 #include <QtGui/QAction>
 #include <QtGui/QDrag>
@@ -35,6 +38,9 @@
 #include <QtWidgets/QTextEdit>
 #include <QtWidgets/QTreeView>
 
+#include "ImageKernels.h"
+#include "Telemetry.h"
+
 class QCheckBox;
 class QFileDialog;
 class QGridLayout;
@@ -49,6 +55,10 @@ class ListModel;
 
 class PyCanvas;
 
+// forget the methods resolved when dispatching to the Python object held in the variant, if any. called
+// before a widget replaces its Python object.
+void ForgetPyMethods(const QVariant &py_object);
+
 class DocumentWindow : public QMainWindow
 {
     Q_OBJECT
@@ -56,7 +66,7 @@ class DocumentWindow : public QMainWindow
 public:
     DocumentWindow(const QString &title, QWidget *parent = 0);
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
     void initialize();
 
@@ -109,7 +119,7 @@ class DockWidget : public QDockWidget
 public:
     DockWidget(const QString &title, QWidget *parent = 0);
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
     virtual void focusInEvent(QFocusEvent *event) override;
     virtual void focusOutEvent(QFocusEvent *event) override;
@@ -138,7 +148,7 @@ class PyAction : public QAction
 public:
     PyAction(QObject *parent);
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
 public Q_SLOTS:
     void triggered();
@@ -155,7 +165,7 @@ class PyMenu : public QMenu
 public:
     PyMenu();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
 public Q_SLOTS:
     void aboutToShow();
@@ -173,7 +183,7 @@ class Drag : public QDrag
 public:
     Drag(QWidget *widget);
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
 public Q_SLOTS:
     void execute();
@@ -192,7 +202,7 @@ public:
 
     void setModelAndConnect(ItemModel *py_item_model);
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
     // Override
     virtual void keyPressEvent(QKeyEvent *event) override;
@@ -226,7 +236,7 @@ class ItemModel : public QAbstractItemModel
 public:
     ItemModel(QObject *parent = 0);
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
     Qt::DropAction lastDropAction() const { return m_last_drop_action; }
 
@@ -289,9 +299,72 @@ struct RenderedTimeStamp
 
 typedef QList<RenderedTimeStamp> RenderedTimeStamps;
 
-typedef std::shared_ptr<std::vector<quint32>> CommandsSharedPtr;
+// a binary drawing command stream. the commands are either a copy or reference memory kept
+// alive by the owner (for instance a Python buffer), which is released with the commands.
+class CommandBuffer
+{
+public:
+    CommandBuffer(const quint32 *commands, size_t size)
+    : m_copy(commands, commands + size), m_commands(m_copy.data()), m_size(size) { }
+    CommandBuffer(const quint32 *commands, size_t size, const std::shared_ptr<void> &owner)
+    : m_commands(commands), m_size(size), m_owner(owner) { }
+    CommandBuffer(const CommandBuffer &) = delete;
+    CommandBuffer &operator=(const CommandBuffer &) = delete;
+
+    const quint32 *data() const { return m_commands; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+private:
+    std::vector<quint32> m_copy;
+    const quint32 *m_commands;
+    size_t m_size;
+    std::shared_ptr<void> m_owner;
+};
+
+typedef std::shared_ptr<CommandBuffer> CommandsSharedPtr;
+
+// image arrays referenced by the drawing commands, by image id. the buffers are pinned when the
+// commands are submitted so that rendering does not need the Python GIL.
+typedef QMap<int, ImageKernels::ImageBuffer> ImageBufferMap;
+
+// parse a CSS style color string (#rgb, #rrggbb, rgb(), rgba() or a color name).
+QColor ParseColorString(const QString &color_string);
+
+// release the images cached for the imag command. must be called before Python is finalized.
+void ClearImageCache();
+
+// the number of times each binary drawing command ran and the time spent in it, keyed by command
+// (for instance 0x7374726b for strk). parts of the rendering are keyed by pseudo commands: dcod for
+// decoding the commands, imgc and datc for the image conversion within imag and data, and rndr for
+// rendering a whole canvas section.
+struct CommandTiming
+{
+    qint64 count = 0;
+    qint64 elapsed_ns = 0;
+};
+
+typedef QMap<quint32, CommandTiming> CommandProfile;
+
+// the four character name of a binary drawing command.
+QString CommandName(quint32 cmd);
+
+// opt-in profiling of the binary drawing commands rendered by canvas sections. the profiles are
+// accumulated per section id, combining the sections with the same id in different canvases.
+void SetCanvasProfilingEnabled(bool enabled);
+QMap<int, CommandProfile> CanvasProfiles();
+void ResetCanvasProfiles();
+
+// the number of canvas section renders that reused a back buffer (hits) or allocated one (misses).
+struct BackBufferStats
+{
+    qint64 hits = 0;
+    qint64 misses = 0;
+};
+
+BackBufferStats CanvasBackBufferStats();
 
-RenderedTimeStamps PaintBinaryCommands(QPainter *painter, const CommandsSharedPtr &commands, const QMap<QString, QVariant> &imageMap, const RenderedTimeStamps &lastRenderedTimestamps, float display_scaling = 0.0, int section_id = 0, float devicePixelRatio = 1.0);
+// paint binary drawing commands. if profile is not null, the time spent in each command is added to it.
+RenderedTimeStamps PaintBinaryCommands(QPainter *painter, const CommandsSharedPtr &commands, const ImageBufferMap &image_buffers, const RenderedTimeStamps &lastRenderedTimestamps, float display_scaling = 0.0, int section_id = 0, float devicePixelRatio = 1.0, CommandProfile *profile = nullptr);
 
 class PyStyledItemDelegate : public QStyledItemDelegate
 {
@@ -299,7 +372,7 @@ class PyStyledItemDelegate : public QStyledItemDelegate
 public:
     PyStyledItemDelegate();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
     virtual void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
     virtual QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
@@ -317,7 +390,7 @@ class PyPushButton : public QPushButton
 public:
     PyPushButton();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
 private Q_SLOTS:
     void clicked();
@@ -332,7 +405,7 @@ class PyRadioButton : public QRadioButton
 public:
     PyRadioButton();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
 private Q_SLOTS:
     void clicked();
@@ -347,7 +420,7 @@ class PyButtonGroup : public QButtonGroup
 public:
     PyButtonGroup();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
 private Q_SLOTS:
     void buttonClicked(QAbstractButton *button);
@@ -362,7 +435,7 @@ class PyTextEdit : public QTextEdit
 public:
     PyTextEdit();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
     virtual void focusInEvent(QFocusEvent *event) override;
     virtual void focusOutEvent(QFocusEvent *event) override;
@@ -384,7 +457,7 @@ class PyTextBrowser : public QTextBrowser
 public:
     PyTextBrowser();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
     virtual void focusInEvent(QFocusEvent *event) override;
     virtual void focusOutEvent(QFocusEvent *event) override;
@@ -404,7 +477,7 @@ class PyCheckBox : public QCheckBox
 public:
     PyCheckBox();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
 private Q_SLOTS:
     void stateChanged(int state);
@@ -419,7 +492,7 @@ class PyComboBox : public QComboBox
 public:
     PyComboBox();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
 private Q_SLOTS:
     void currentTextChanged(const QString &currentText);
@@ -438,7 +511,7 @@ class PySlider : public QSlider
 public:
     PySlider();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
 private Q_SLOTS:
     void valueChanged(int value);
@@ -456,7 +529,7 @@ class PyLineEdit : public QLineEdit
 public:
     PyLineEdit();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
     virtual void keyPressEvent(QKeyEvent *event) override;
     virtual void focusInEvent(QFocusEvent *event) override;
@@ -476,7 +549,7 @@ class PyScrollArea : public QScrollArea
 public:
     PyScrollArea();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
     virtual void resizeEvent(QResizeEvent *event) override;
     virtual bool eventFilter(QObject *obj, QEvent *event) override;
@@ -499,7 +572,7 @@ class PyTabWidget : public QTabWidget
 public:
     PyTabWidget();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
 public Q_SLOTS:
     void currentChanged(int index);
@@ -522,39 +595,90 @@ private:
 class PyCanvas;
 class PyCanvasRenderTask;
 
+/*
+ The drawing commands for a canvas section.
+
+ The dirty rect, relative to the section rect, limits the region that changed since the previous
+ drawing commands of the section. If it is empty, the whole section is repainted.
+ */
 class DrawingCommands
 {
 public:
-    DrawingCommands(const CommandsSharedPtr &commands, const QRect &rect, const QMap<QString, QVariant> &image_map)
-    : m_commands(commands), m_rect(rect), m_image_map(image_map) { }
+    DrawingCommands(const CommandsSharedPtr &commands, const QRect &rect, const ImageBufferMap &image_buffers, const QRect &dirty_rect = QRect())
+    : m_commands(commands), m_image_buffers(image_buffers), m_rect(rect), m_dirty_rect(dirty_rect) { }
 
     const CommandsSharedPtr commands() const { return m_commands; }
-    const QMap<QString, QVariant> &imageMap() const { return m_image_map; }
+    const ImageBufferMap &imageBuffers() const { return m_image_buffers; }
     const QRect &rect() const { return m_rect; }
+    const QRect &dirtyRect() const { return m_dirty_rect; }
+
+    // extend the dirty rect to include the changes of skipped drawing commands.
+    void includeDirtyRect(const QRect &dirty_rect)
+    {
+        if (m_dirty_rect.isEmpty() || dirty_rect.isEmpty())
+            m_dirty_rect = QRect();
+        else
+            m_dirty_rect = m_dirty_rect.united(dirty_rect);
+    }
 private:
     CommandsSharedPtr m_commands;
-    QMap<QString, QVariant> m_image_map;
+    ImageBufferMap m_image_buffers;
     QRect m_rect;
+    QRect m_dirty_rect;
 };
 
 typedef std::shared_ptr<DrawingCommands> DrawingCommandsSharedPtr;
 
+/*
+ The rendered bitmap of a canvas section.
+
+ It is not modified once it is published to the paint event, except for the time it was first painted,
+ which the paint event records so that the next rendering can draw the latency.
+ */
+struct CanvasSectionImage
+{
+    QSharedPointer<QImage> image;
+    QRect image_rect;
+    RenderedTimeStamps rendered_timestamps;
+    bool record_latency = false;
+    mutable std::atomic<int64_t> painted_ns{0};
+    Telemetry::HistogramSharedPtr latency;  // the section's latency histogram
+    Telemetry::HistogramSharedPtr frame_interval;  // the section's frame interval histogram
+
+    // the rendered timestamps with the elapsed time until the first paint, if painted.
+    RenderedTimeStamps paintedTimeStamps() const;
+};
+
+typedef std::shared_ptr<const CanvasSectionImage> CanvasSectionImageSharedPtr;
+typedef QMap<int, CanvasSectionImageSharedPtr> CanvasSectionImages;
+
 class CanvasSection
 {
 public:
     int m_section_id;
     DrawingCommandsSharedPtr m_pending_drawing_commands;
     float m_device_pixel_ratio;
-    QRect image_rect;
-    QSharedPointer<QImage> image;
-    RenderedTimeStamps m_rendered_timestamps;
+    CanvasSectionImageSharedPtr m_image;
     PyCanvasRenderTask *m_render_task;
-    QQueue<int64_t> latencies_ns;
-    QQueue<int64_t> timestamps_ns;
-    bool record_latency;
     bool closing;
 
-    CanvasSection(int section_id, float device_pixel_ratio);
+    // telemetry, in nanoseconds. named <telemetry prefix>.<metric>.
+    const QString m_telemetry_prefix;
+    const Telemetry::HistogramSharedPtr m_render_time;
+    const Telemetry::HistogramSharedPtr m_queue_wait;
+    const Telemetry::HistogramSharedPtr m_latency;
+    const Telemetry::HistogramSharedPtr m_frame_interval;
+
+    CanvasSection(int section_id, float device_pixel_ratio, const QString &telemetry_prefix);
+
+    // take a back buffer of the given size from the pool, or allocate one; its contents are undefined.
+    QImage acquireBackBuffer(const QSize &size);
+    // return a back buffer to the pool. it is reused once no published image references it.
+    void releaseBackBuffer(const QImage &back_buffer);
+
+private:
+    // only accessed by the render task of the section; the section renders one task at a time.
+    QList<QImage> m_back_buffers;
 };
 
 typedef std::shared_ptr<CanvasSection> CanvasSectionSharedPtr;
@@ -582,13 +706,13 @@ struct RenderResult
 /*
  A task to render a canvas section.
 
- The rendered timestamps are passed in as const. They are not updated on the section directly and instead a
- new copy is put into the RenderResult and the section is updated at paint time.
+ The previous image of the section is passed in as const. The rendered timestamps of the new image are put
+ into the RenderResult and the section is updated with the new image when rendering finishes.
  */
 class PyCanvasRenderTask : public QRunnable
 {
 public:
-    PyCanvasRenderTask(PyCanvas *canvas, const CanvasSectionSharedPtr &section, const DrawingCommandsSharedPtr &drawing_commands, float devicePixelRatio, const RenderedTimeStamps &rendered_timestamps);
+    PyCanvasRenderTask(PyCanvas *canvas, const CanvasSectionSharedPtr &section, const DrawingCommandsSharedPtr &drawing_commands, float devicePixelRatio, const CanvasSectionImageSharedPtr &previous_image);
 
     virtual void run() override;
 
@@ -599,7 +723,8 @@ private:
     const CanvasSectionSharedPtr m_section;
     const DrawingCommandsSharedPtr m_drawing_commands;
     float m_device_pixel_ratio;
-    const RenderedTimeStamps m_rendered_timestamps;
+    const CanvasSectionImageSharedPtr m_previous_image;
+    const int64_t m_created_ns;  // queue wait telemetry
 };
 
 class PyCanvas : public QWidget
@@ -609,7 +734,7 @@ public:
     PyCanvas();
     ~PyCanvas();
 
-    void setPyObject(const QVariant &py_object) { m_py_object = py_object; }
+    void setPyObject(const QVariant &py_object) { ForgetPyMethods(m_py_object); m_py_object = py_object; }
 
     virtual bool event(QEvent *event) override;
 
@@ -626,6 +751,9 @@ public:
 
     virtual void paintEvent(QPaintEvent *event) override;
     virtual void resizeEvent(QResizeEvent *event) override;
+    virtual void moveEvent(QMoveEvent *event) override;
+    virtual void showEvent(QShowEvent *event) override;
+    virtual void hideEvent(QHideEvent *event) override;
 
     virtual void keyPressEvent(QKeyEvent *event) override;
     virtual void keyReleaseEvent(QKeyEvent *event) override;
@@ -646,15 +774,32 @@ public:
 
     void continuePaintingSection(const RenderResult &render_result);
 
+    // request a repaint of the canvas. thread safe.
+    void requestRepaint();
+
 private:
+    void scheduleRepaint();
+    void publishSectionImages();
+    void updateVisibleRect();
+    void setVisibleRect(const QRect &visible_rect);
+    bool isRectVisible(const QRect &rect) const;  // call with m_sections_mutex held
+
     bool m_closing;
     QVariant m_py_object;
     QMutex m_sections_mutex;
     QMap<int, CanvasSectionSharedPtr> m_sections;
+    QRect m_visible_rect;  // written on the main thread with m_sections_mutex held
+    bool m_visible_rect_update_queued;  // main thread only
+    std::shared_ptr<const CanvasSectionImages> m_section_images;  // accessed atomically
+    QString m_telemetry_prefix;  // canvas.<serial number>
+    Telemetry::HistogramSharedPtr m_paint_time;
     QPoint m_last_pos;
     bool m_pressed;
     unsigned m_grab_mouse_count;
     QPoint m_grab_reference_point;
+    std::atomic<bool> m_repaint_requested;
+    QTimer m_repaint_timer;
+    QElapsedTimer m_last_repaint_timer;
 };
 
 QWidget *Widget_makeIntrinsicWidget(const QString &intrinsic_id);
@@ -0,0 +1,1211 @@
+/*
+ Copyright (c) 2012-2024 Bruker, Inc.
+*/
+
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "ImageKernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define IMAGE_KERNELS_X86 1
+#else
+#define IMAGE_KERNELS_X86 0
+#endif
+
+#if IMAGE_KERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// msvc allows avx2 intrinsics in any function; the caller is responsible for checking support.
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+
+typedef void (*QuantizeFn)(const float *src, uint8_t *dst, long count, float low, float high, float m);
+typedef void (*ScaleAndQuantizeFn)(const float *src, uint8_t *dst, long count, float scale, float low, float high, float m);
+typedef void (*AccumulateRunsFn)(const float *src, const int32_t *starts, const int32_t *lengths, long run_count, int32_t max_length, float *line);
+typedef void (*MinMaxFn)(const float *src, long count, float *minimum, float *maximum);
+typedef void (*MapColorsFn)(const float *src, uint32_t *dst, long count, float scale, float low, float high, float m, const uint32_t *lookup_table, int32_t max_index);
+typedef void (*AccumulateRGBAFn)(const uint32_t *src, uint32_t *sums, long count);
+typedef void (*AccumulateRGBARunsFn)(const uint32_t *sums, const int32_t *starts, const int32_t *lengths, long run_count, float *line);
+
+struct Kernels
+{
+    const char *name;
+    QuantizeFn quantize;
+    ScaleAndQuantizeFn scaleAndQuantize;
+    AccumulateRunsFn accumulateRuns;
+    MinMaxFn minMax;
+    MapColorsFn mapColors;
+    AccumulateRGBAFn accumulateRGBA;
+    AccumulateRGBARunsFn accumulateRGBARuns;
+};
+
+// the runs of source pixels contributing to each destination pixel along one axis.
+// the run boundaries are computed exactly as the original scalar downsampling code did
+// so that the output is unchanged.
+struct Runs
+{
+    std::vector<int32_t> starts;
+    std::vector<int32_t> lengths;
+    std::vector<long> indexes;
+    int32_t max_length = 0;
+
+    Runs(long count, long dest_count)
+    {
+        long last_index = -1;
+        for (long i=0; i<count; ++i)
+        {
+            long index = floor(i / (float(count) / dest_count));
+            if (index != last_index)
+            {
+                starts.push_back(int32_t(i));
+                indexes.push_back(index);
+                last_index = index;
+            }
+        }
+        for (size_t k=0; k<starts.size(); ++k)
+        {
+            int32_t end = k + 1 < starts.size() ? starts[k + 1] : int32_t(count);
+            lengths.push_back(end - starts[k]);
+            max_length = std::max(max_length, end - starts[k]);
+        }
+    }
+
+    long size() const { return long(starts.size()); }
+};
+
+inline uint8_t quantizeValue(float v, float low, float high, float m)
+{
+    if (v < low)
+        return 0x00;
+    else if (v > high)
+        return 0xFF;
+    else
+        return (unsigned char)((v - low) * m);
+}
+
+void quantizeScalar(const float *src, uint8_t *dst, long count, float low, float high, float m)
+{
+    for (long i=0; i<count; ++i)
+        dst[i] = quantizeValue(src[i], low, high, m);
+}
+
+void scaleAndQuantizeScalar(const float *src, uint8_t *dst, long count, float scale, float low, float high, float m)
+{
+    for (long i=0; i<count; ++i)
+        dst[i] = quantizeValue(src[i] * scale, low, high, m);
+}
+
+void accumulateRunsScalar(const float *src, const int32_t *starts, const int32_t *lengths, long run_count, int32_t /*max_length*/, float *line)
+{
+    for (long k=0; k<run_count; ++k)
+    {
+        const float *p = src + starts[k];
+        const int32_t length = lengths[k];
+        float sum = p[0];
+        for (int32_t i=1; i<length; ++i)
+            sum += p[i];
+        line[k] += sum / length;
+    }
+}
+
+// update the minimum and maximum with the values. NaN values are skipped: a comparison with NaN is false.
+void minMaxScalar(const float *src, long count, float *minimum, float *maximum)
+{
+    float mn = *minimum;
+    float mx = *maximum;
+    for (long i=0; i<count; ++i)
+    {
+        mn = src[i] < mn ? src[i] : mn;
+        mx = src[i] > mx ? src[i] : mx;
+    }
+    *minimum = mn;
+    *maximum = mx;
+}
+
+// the lookup table index of a value, with the same tests as quantizeValue. values that are NaN after the
+// multiplication map to the first entry, as they do when quantized.
+inline int32_t colorIndex(float v, float low, float high, float m, int32_t max_index)
+{
+    if (v < low)
+        return 0;
+    else if (v > high)
+        return max_index;
+    const float index = (v - low) * m;
+    if (!(index >= 0.0f))
+        return 0;
+    return index < float(max_index) ? int32_t(index) : max_index;
+}
+
+void mapColorsScalar(const float *src, uint32_t *dst, long count, float scale, float low, float high, float m, const uint32_t *lookup_table, int32_t max_index)
+{
+    for (long i=0; i<count; ++i)
+        dst[i] = lookup_table[colorIndex(src[i] * scale, low, high, m, max_index)];
+}
+
+// the maximum number of rows summed into the 32 bit column sums before they are added to a float line.
+const long RGBA_ROW_CHUNK = 32768;
+
+// add the premultiplied channels of ARGB32 pixels to four sums per pixel, in memory order (blue, green, red,
+// alpha). the color channels are multiplied by alpha and alpha by 255, so all sums share the same scale. the
+// sums of up to RGBA_ROW_CHUNK rows stay below 2^31.
+void accumulateRGBAScalar(const uint32_t *src, uint32_t *sums, long count)
+{
+    for (long i=0; i<count; ++i)
+    {
+        const uint32_t argb = src[i];
+        const uint32_t a = argb >> 24;
+        uint32_t *sum = sums + i * 4;
+        sum[0] += (argb & 0xFF) * a;
+        sum[1] += ((argb >> 8) & 0xFF) * a;
+        sum[2] += ((argb >> 16) & 0xFF) * a;
+        sum[3] += a * 255;
+    }
+}
+
+// add the column sums of each run of pixels to the four channels of the next entry of the line. x86-64 uses
+// the sse2 version unless the scalar kernels are selected, since it needs no scalar remainder.
+void accumulateRGBARunsScalar(const uint32_t *sums, const int32_t *starts, const int32_t *lengths, long run_count, float *line)
+{
+    for (long k=0; k<run_count; ++k)
+    {
+        const uint32_t *sum = sums + starts[k] * 4;
+        for (int32_t i=0; i<lengths[k]; ++i)
+            for (int c=0; c<4; ++c)
+                line[k * 4 + c] += float(sum[i * 4 + c]);
+    }
+}
+
+#if IMAGE_KERNELS_X86
+
+// quantize four values. the greater-than mask is applied before the less-than mask so
+// that the less-than test takes precedence, matching the order of the scalar tests. lanes
+// that fail both tests but are NaN convert to 0x80000000 and saturate to 0 when packed,
+// which is also what the scalar conversion produces.
+inline __m128i quantize4SSE2(__m128 v, __m128 low, __m128 high, __m128 m)
+{
+    __m128i q = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(v, low), m));
+    __m128i gt = _mm_castps_si128(_mm_cmpgt_ps(v, high));
+    __m128i lt = _mm_castps_si128(_mm_cmplt_ps(v, low));
+    q = _mm_or_si128(_mm_andnot_si128(gt, q), _mm_and_si128(gt, _mm_set1_epi32(0xFF)));
+    return _mm_andnot_si128(lt, q);
+}
+
+inline void store16SSE2(uint8_t *dst, __m128i q0, __m128i q1, __m128i q2, __m128i q3)
+{
+    __m128i lo = _mm_packs_epi32(q0, q1);
+    __m128i hi = _mm_packs_epi32(q2, q3);
+    _mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(lo, hi));
+}
+
+void quantizeSSE2(const float *src, uint8_t *dst, long count, float low, float high, float m)
+{
+    const __m128 low4 = _mm_set1_ps(low);
+    const __m128 high4 = _mm_set1_ps(high);
+    const __m128 m4 = _mm_set1_ps(m);
+    long i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i q0 = quantize4SSE2(_mm_loadu_ps(src + i), low4, high4, m4);
+        __m128i q1 = quantize4SSE2(_mm_loadu_ps(src + i + 4), low4, high4, m4);
+        __m128i q2 = quantize4SSE2(_mm_loadu_ps(src + i + 8), low4, high4, m4);
+        __m128i q3 = quantize4SSE2(_mm_loadu_ps(src + i + 12), low4, high4, m4);
+        store16SSE2(dst + i, q0, q1, q2, q3);
+    }
+    quantizeScalar(src + i, dst + i, count - i, low, high, m);
+}
+
+void scaleAndQuantizeSSE2(const float *src, uint8_t *dst, long count, float scale, float low, float high, float m)
+{
+    const __m128 scale4 = _mm_set1_ps(scale);
+    const __m128 low4 = _mm_set1_ps(low);
+    const __m128 high4 = _mm_set1_ps(high);
+    const __m128 m4 = _mm_set1_ps(m);
+    long i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i q0 = quantize4SSE2(_mm_mul_ps(_mm_loadu_ps(src + i), scale4), low4, high4, m4);
+        __m128i q1 = quantize4SSE2(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale4), low4, high4, m4);
+        __m128i q2 = quantize4SSE2(_mm_mul_ps(_mm_loadu_ps(src + i + 8), scale4), low4, high4, m4);
+        __m128i q3 = quantize4SSE2(_mm_mul_ps(_mm_loadu_ps(src + i + 12), scale4), low4, high4, m4);
+        store16SSE2(dst + i, q0, q1, q2, q3);
+    }
+    scaleAndQuantizeScalar(src + i, dst + i, count - i, scale, low, high, m);
+}
+
+// sum four runs at once, one run per lane. each lane adds its run's values in source order
+// so the sums are identical to the scalar sums; lanes whose run is shorter keep their sum.
+// runs are contiguous, so four runs of two or four pixels are deinterleaved from plain loads.
+void accumulateRunsSSE2(const float *src, const int32_t *starts, const int32_t *lengths, long run_count, int32_t max_length, float *line)
+{
+    long k = 0;
+    for (; k + 4 <= run_count; k += 4)
+    {
+        const float *p0 = src + starts[k];
+        const float *p1 = src + starts[k + 1];
+        const float *p2 = src + starts[k + 2];
+        const float *p3 = src + starts[k + 3];
+        const int32_t l0 = lengths[k], l1 = lengths[k + 1], l2 = lengths[k + 2], l3 = lengths[k + 3];
+        const __m128i length4 = _mm_loadu_si128((const __m128i *)(lengths + k));
+        __m128 sum;
+        if (l0 == 2 && l1 == 2 && l2 == 2 && l3 == 2)
+        {
+            const __m128 v0 = _mm_loadu_ps(p0);
+            const __m128 v1 = _mm_loadu_ps(p0 + 4);
+            sum = _mm_add_ps(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+        else if (l0 == 4 && l1 == 4 && l2 == 4 && l3 == 4)
+        {
+            __m128 v0 = _mm_loadu_ps(p0);
+            __m128 v1 = _mm_loadu_ps(p0 + 4);
+            __m128 v2 = _mm_loadu_ps(p0 + 8);
+            __m128 v3 = _mm_loadu_ps(p0 + 12);
+            _MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+            sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(v0, v1), v2), v3);
+        }
+        else
+        {
+            sum = _mm_setr_ps(p0[0], p1[0], p2[0], p3[0]);
+            for (int32_t i=1; i<max_length; ++i)
+            {
+                __m128 v = _mm_setr_ps(i < l0 ? p0[i] : 0.0f, i < l1 ? p1[i] : 0.0f, i < l2 ? p2[i] : 0.0f, i < l3 ? p3[i] : 0.0f);
+                __m128 active = _mm_castsi128_ps(_mm_cmpgt_epi32(length4, _mm_set1_epi32(i)));
+                sum = _mm_or_ps(_mm_and_ps(active, _mm_add_ps(sum, v)), _mm_andnot_ps(active, sum));
+            }
+        }
+        __m128 average = _mm_div_ps(sum, _mm_cvtepi32_ps(length4));
+        _mm_storeu_ps(line + k, _mm_add_ps(_mm_loadu_ps(line + k), average));
+    }
+    accumulateRunsScalar(src, starts + k, lengths + k, run_count - k, max_length, line + k);
+}
+
+// minps and maxps return the second operand if either is NaN, so NaN values are skipped as in the scalar
+// version. the minimum and maximum do not depend on the order of evaluation, so the results are identical.
+void minMaxSSE2(const float *src, long count, float *minimum, float *maximum)
+{
+    __m128 mn4 = _mm_set1_ps(*minimum);
+    __m128 mx4 = _mm_set1_ps(*maximum);
+    long i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128 v = _mm_loadu_ps(src + i);
+        mn4 = _mm_min_ps(v, mn4);
+        mx4 = _mm_max_ps(v, mx4);
+    }
+    float mn[4];
+    float mx[4];
+    _mm_storeu_ps(mn, mn4);
+    _mm_storeu_ps(mx, mx4);
+    *minimum = std::min(std::min(mn[0], mn[1]), std::min(mn[2], mn[3]));
+    *maximum = std::max(std::max(mx[0], mx[1]), std::max(mx[2], mx[3]));
+    minMaxScalar(src + i, count - i, minimum, maximum);
+}
+
+// the lookup table indexes of four values. the index is limited to the last entry before conversion; minps
+// returns its second operand, the index, if either is NaN. NaN lanes convert to 0x80000000, which is negative
+// and is clamped to the first entry like the scalar version.
+inline __m128i colorIndex4SSE2(__m128 v, __m128 low, __m128 high, __m128 m, __m128 max_index_f, __m128i max_index)
+{
+    __m128i q = _mm_cvttps_epi32(_mm_min_ps(max_index_f, _mm_mul_ps(_mm_sub_ps(v, low), m)));
+    q = _mm_and_si128(q, _mm_cmpgt_epi32(q, _mm_setzero_si128()));
+    __m128i gt = _mm_castps_si128(_mm_cmpgt_ps(v, high));
+    __m128i lt = _mm_castps_si128(_mm_cmplt_ps(v, low));
+    q = _mm_or_si128(_mm_andnot_si128(gt, q), _mm_and_si128(gt, max_index));
+    return _mm_andnot_si128(lt, q);
+}
+
+// sse2 has no gather, so the indexes are computed four at a time and looked up with an unrolled loop.
+void mapColorsSSE2(const float *src, uint32_t *dst, long count, float scale, float low, float high, float m, const uint32_t *lookup_table, int32_t max_index)
+{
+    const __m128 scale4 = _mm_set1_ps(scale);
+    const __m128 low4 = _mm_set1_ps(low);
+    const __m128 high4 = _mm_set1_ps(high);
+    const __m128 m4 = _mm_set1_ps(m);
+    const __m128 max_index_f4 = _mm_set1_ps(float(max_index));
+    const __m128i max_index4 = _mm_set1_epi32(max_index);
+    alignas(16) int32_t indexes[8];
+    long i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm_store_si128((__m128i *)indexes, colorIndex4SSE2(_mm_mul_ps(_mm_loadu_ps(src + i), scale4), low4, high4, m4, max_index_f4, max_index4));
+        _mm_store_si128((__m128i *)(indexes + 4), colorIndex4SSE2(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale4), low4, high4, m4, max_index_f4, max_index4));
+        dst[i] = lookup_table[indexes[0]];
+        dst[i + 1] = lookup_table[indexes[1]];
+        dst[i + 2] = lookup_table[indexes[2]];
+        dst[i + 3] = lookup_table[indexes[3]];
+        dst[i + 4] = lookup_table[indexes[4]];
+        dst[i + 5] = lookup_table[indexes[5]];
+        dst[i + 6] = lookup_table[indexes[6]];
+        dst[i + 7] = lookup_table[indexes[7]];
+    }
+    mapColorsScalar(src + i, dst + i, count - i, scale, low, high, m, lookup_table, max_index);
+}
+
+// premultiply four pixels unpacked to 16 bits per channel. each product is at most 255 * 255, so the low 16 bits are exact.
+inline void accumulate2RGBASSE2(__m128i pixels16, __m128i alpha_mask, __m128i max_alpha, uint32_t *sums)
+{
+    const __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    const __m128i multiplier = _mm_or_si128(_mm_andnot_si128(alpha_mask, alpha), max_alpha);
+    const __m128i products = _mm_mullo_epi16(pixels16, multiplier);
+    const __m128i zero = _mm_setzero_si128();
+    _mm_storeu_si128((__m128i *)sums, _mm_add_epi32(_mm_loadu_si128((const __m128i *)sums), _mm_unpacklo_epi16(products, zero)));
+    _mm_storeu_si128((__m128i *)(sums + 4), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(sums + 4)), _mm_unpackhi_epi16(products, zero)));
+}
+
+void accumulateRGBASSE2(const uint32_t *src, uint32_t *sums, long count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha_mask = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+    const __m128i max_alpha = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+    long i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128i pixels = _mm_loadu_si128((const __m128i *)(src + i));
+        accumulate2RGBASSE2(_mm_unpacklo_epi8(pixels, zero), alpha_mask, max_alpha, sums + i * 4);
+        accumulate2RGBASSE2(_mm_unpackhi_epi8(pixels, zero), alpha_mask, max_alpha, sums + i * 4 + 8);
+    }
+    accumulateRGBAScalar(src + i, sums + i * 4, count - i);
+}
+
+// the four channels of a pixel are in one vector, so each run is summed with one add per pixel. the column sums
+// of a run are added in order, so the results are identical to the scalar version.
+void accumulateRGBARunsSSE2(const uint32_t *sums, const int32_t *starts, const int32_t *lengths, long run_count, float *line)
+{
+    for (long k=0; k<run_count; ++k)
+    {
+        const uint32_t *sum = sums + starts[k] * 4;
+        __m128 total = _mm_loadu_ps(line + k * 4);
+        for (int32_t i=0; i<lengths[k]; ++i)
+            total = _mm_add_ps(total, _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(sum + i * 4))));
+        _mm_storeu_ps(line + k * 4, total);
+    }
+}
+
+TARGET_AVX2 inline __m256i quantize8AVX2(__m256 v, __m256 low, __m256 high, __m256 m)
+{
+    __m256i q = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(v, low), m));
+    __m256i gt = _mm256_castps_si256(_mm256_cmp_ps(v, high, _CMP_GT_OQ));
+    __m256i lt = _mm256_castps_si256(_mm256_cmp_ps(v, low, _CMP_LT_OQ));
+    q = _mm256_blendv_epi8(q, _mm256_set1_epi32(0xFF), gt);
+    return _mm256_andnot_si256(lt, q);
+}
+
+TARGET_AVX2 inline void store32AVX2(uint8_t *dst, __m256i q0, __m256i q1, __m256i q2, __m256i q3)
+{
+    // the packs operate within 128-bit lanes; the permute restores the source order.
+    __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(q0, q1), _mm256_packs_epi32(q2, q3));
+    packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+    _mm256_storeu_si256((__m256i *)dst, packed);
+}
+
+TARGET_AVX2 void quantizeAVX2(const float *src, uint8_t *dst, long count, float low, float high, float m)
+{
+    const __m256 low8 = _mm256_set1_ps(low);
+    const __m256 high8 = _mm256_set1_ps(high);
+    const __m256 m8 = _mm256_set1_ps(m);
+    long i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i q0 = quantize8AVX2(_mm256_loadu_ps(src + i), low8, high8, m8);
+        __m256i q1 = quantize8AVX2(_mm256_loadu_ps(src + i + 8), low8, high8, m8);
+        __m256i q2 = quantize8AVX2(_mm256_loadu_ps(src + i + 16), low8, high8, m8);
+        __m256i q3 = quantize8AVX2(_mm256_loadu_ps(src + i + 24), low8, high8, m8);
+        store32AVX2(dst + i, q0, q1, q2, q3);
+    }
+    quantizeSSE2(src + i, dst + i, count - i, low, high, m);
+}
+
+TARGET_AVX2 void scaleAndQuantizeAVX2(const float *src, uint8_t *dst, long count, float scale, float low, float high, float m)
+{
+    const __m256 scale8 = _mm256_set1_ps(scale);
+    const __m256 low8 = _mm256_set1_ps(low);
+    const __m256 high8 = _mm256_set1_ps(high);
+    const __m256 m8 = _mm256_set1_ps(m);
+    long i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i q0 = quantize8AVX2(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale8), low8, high8, m8);
+        __m256i q1 = quantize8AVX2(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale8), low8, high8, m8);
+        __m256i q2 = quantize8AVX2(_mm256_mul_ps(_mm256_loadu_ps(src + i + 16), scale8), low8, high8, m8);
+        __m256i q3 = quantize8AVX2(_mm256_mul_ps(_mm256_loadu_ps(src + i + 24), scale8), low8, high8, m8);
+        store32AVX2(dst + i, q0, q1, q2, q3);
+    }
+    scaleAndQuantizeSSE2(src + i, dst + i, count - i, scale, low, high, m);
+}
+
+// sum eight runs at once, one run per lane, in the same order as the scalar sums. runs are
+// contiguous, so eight runs of two or four pixels are deinterleaved from plain loads; other
+// run lengths use gathers.
+TARGET_AVX2 void accumulateRunsAVX2(const float *src, const int32_t *starts, const int32_t *lengths, long run_count, int32_t max_length, float *line)
+{
+    long k = 0;
+    for (; k + 8 <= run_count; k += 8)
+    {
+        const __m256i start8 = _mm256_loadu_si256((const __m256i *)(starts + k));
+        const __m256i length8 = _mm256_loadu_si256((const __m256i *)(lengths + k));
+        const int uniform_2 = _mm256_movemask_epi8(_mm256_cmpeq_epi32(length8, _mm256_set1_epi32(2)));
+        const int uniform_4 = _mm256_movemask_epi8(_mm256_cmpeq_epi32(length8, _mm256_set1_epi32(4)));
+        const float *p = src + starts[k];
+        __m256 sum;
+        if (uniform_2 == -1)
+        {
+            const __m256 v0 = _mm256_loadu_ps(p);
+            const __m256 v1 = _mm256_loadu_ps(p + 8);
+            // lanes hold runs 0, 1, 4, 5, 2, 3, 6, 7 until the final permute.
+            sum = _mm256_add_ps(_mm256_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)), _mm256_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+            sum = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sum), _MM_SHUFFLE(3, 1, 2, 0)));
+        }
+        else if (uniform_4 == -1)
+        {
+            const __m256 v0 = _mm256_loadu_ps(p);
+            const __m256 v1 = _mm256_loadu_ps(p + 8);
+            const __m256 v2 = _mm256_loadu_ps(p + 16);
+            const __m256 v3 = _mm256_loadu_ps(p + 24);
+            // transpose within each 128-bit lane; lanes hold runs 0, 2, 4, 6, 1, 3, 5, 7 until the final permute.
+            const __m256 t0 = _mm256_unpacklo_ps(v0, v1);
+            const __m256 t1 = _mm256_unpackhi_ps(v0, v1);
+            const __m256 t2 = _mm256_unpacklo_ps(v2, v3);
+            const __m256 t3 = _mm256_unpackhi_ps(v2, v3);
+            sum = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+            sum = _mm256_add_ps(sum, _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2)));
+            sum = _mm256_add_ps(sum, _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)));
+            sum = _mm256_add_ps(sum, _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2)));
+            sum = _mm256_permutevar8x32_ps(sum, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+        }
+        else
+        {
+            sum = _mm256_i32gather_ps(src, start8, 4);
+            for (int32_t i=1; i<max_length; ++i)
+            {
+                const __m256i i8 = _mm256_set1_epi32(i);
+                const __m256 active = _mm256_castsi256_ps(_mm256_cmpgt_epi32(length8, i8));
+                const __m256 v = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), src, _mm256_add_epi32(start8, i8), active, 4);
+                sum = _mm256_blendv_ps(sum, _mm256_add_ps(sum, v), active);
+            }
+        }
+        __m256 average = _mm256_div_ps(sum, _mm256_cvtepi32_ps(length8));
+        _mm256_storeu_ps(line + k, _mm256_add_ps(_mm256_loadu_ps(line + k), average));
+    }
+    accumulateRunsSSE2(src, starts + k, lengths + k, run_count - k, max_length, line + k);
+}
+
+TARGET_AVX2 void minMaxAVX2(const float *src, long count, float *minimum, float *maximum)
+{
+    __m256 mn8 = _mm256_set1_ps(*minimum);
+    __m256 mx8 = _mm256_set1_ps(*maximum);
+    long i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m256 v = _mm256_loadu_ps(src + i);
+        mn8 = _mm256_min_ps(v, mn8);
+        mx8 = _mm256_max_ps(v, mx8);
+    }
+    const __m128 mn4 = _mm_min_ps(_mm256_castps256_ps128(mn8), _mm256_extractf128_ps(mn8, 1));
+    const __m128 mx4 = _mm_max_ps(_mm256_castps256_ps128(mx8), _mm256_extractf128_ps(mx8, 1));
+    float mn[4];
+    float mx[4];
+    _mm_storeu_ps(mn, mn4);
+    _mm_storeu_ps(mx, mx4);
+    *minimum = std::min(std::min(mn[0], mn[1]), std::min(mn[2], mn[3]));
+    *maximum = std::max(std::max(mx[0], mx[1]), std::max(mx[2], mx[3]));
+    minMaxSSE2(src + i, count - i, minimum, maximum);
+}
+
+TARGET_AVX2 inline __m256i colorIndex8AVX2(__m256 v, __m256 low, __m256 high, __m256 m, __m256 max_index_f, __m256i max_index)
+{
+    __m256i q = _mm256_cvttps_epi32(_mm256_min_ps(max_index_f, _mm256_mul_ps(_mm256_sub_ps(v, low), m)));
+    q = _mm256_max_epi32(q, _mm256_setzero_si256());
+    __m256i gt = _mm256_castps_si256(_mm256_cmp_ps(v, high, _CMP_GT_OQ));
+    __m256i lt = _mm256_castps_si256(_mm256_cmp_ps(v, low, _CMP_LT_OQ));
+    q = _mm256_blendv_epi8(q, max_index, gt);
+    return _mm256_andnot_si256(lt, q);
+}
+
+// the colors are gathered from the lookup table, which stays in the L1 cache for 256 and 4096 entries.
+TARGET_AVX2 void mapColorsAVX2(const float *src, uint32_t *dst, long count, float scale, float low, float high, float m, const uint32_t *lookup_table, int32_t max_index)
+{
+    const __m256 scale8 = _mm256_set1_ps(scale);
+    const __m256 low8 = _mm256_set1_ps(low);
+    const __m256 high8 = _mm256_set1_ps(high);
+    const __m256 m8 = _mm256_set1_ps(m);
+    const __m256 max_index_f8 = _mm256_set1_ps(float(max_index));
+    const __m256i max_index8 = _mm256_set1_epi32(max_index);
+    const int *table = reinterpret_cast<const int *>(lookup_table);
+    long i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m256i q0 = colorIndex8AVX2(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale8), low8, high8, m8, max_index_f8, max_index8);
+        const __m256i q1 = colorIndex8AVX2(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale8), low8, high8, m8, max_index_f8, max_index8);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_i32gather_epi32(table, q0, 4));
+        _mm256_storeu_si256((__m256i *)(dst + i + 8), _mm256_i32gather_epi32(table, q1, 4));
+    }
+    mapColorsSSE2(src + i, dst + i, count - i, scale, low, high, m, lookup_table, max_index);
+}
+
+// premultiply eight pixels at a time; the 16 bit products are widened to 32 bits in memory order.
+TARGET_AVX2 void accumulateRGBAAVX2(const uint32_t *src, uint32_t *sums, long count)
+{
+    const __m256i alpha_shuffle = _mm256_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15, 6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15);
+    const __m256i alpha_mask = _mm256_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1);
+    const __m256i max_alpha = _mm256_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255);
+    long i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i pixels_lo = _mm_loadu_si128((const __m128i *)(src + i));
+        const __m128i pixels_hi = _mm_loadu_si128((const __m128i *)(src + i + 4));
+        for (int half=0; half<2; ++half)
+        {
+            const __m256i pixels16 = _mm256_cvtepu8_epi16(half == 0 ? pixels_lo : pixels_hi);
+            const __m256i alpha = _mm256_shuffle_epi8(pixels16, alpha_shuffle);
+            const __m256i products = _mm256_mullo_epi16(pixels16, _mm256_or_si256(_mm256_andnot_si256(alpha_mask, alpha), max_alpha));
+            uint32_t *sum = sums + (i + half * 4) * 4;
+            const __m256i products_lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(products));
+            const __m256i products_hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(products, 1));
+            _mm256_storeu_si256((__m256i *)sum, _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)sum), products_lo));
+            _mm256_storeu_si256((__m256i *)(sum + 8), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(sum + 8)), products_hi));
+        }
+    }
+    accumulateRGBASSE2(src + i, sums + i * 4, count - i);
+}
+
+bool cpuSupportsAVX2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+    if (!os_saves_ymm)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+// the kernels for the instruction sets supported by the processor, best first. the scalar kernels are last.
+std::vector<Kernels> supportedKernels()
+{
+    std::vector<Kernels> supported;
+#if IMAGE_KERNELS_X86
+    if (cpuSupportsAVX2())
+        supported.push_back({ "avx2", quantizeAVX2, scaleAndQuantizeAVX2, accumulateRunsAVX2, minMaxAVX2, mapColorsAVX2, accumulateRGBAAVX2, accumulateRGBARunsSSE2 });
+    supported.push_back({ "sse2", quantizeSSE2, scaleAndQuantizeSSE2, accumulateRunsSSE2, minMaxSSE2, mapColorsSSE2, accumulateRGBASSE2, accumulateRGBARunsSSE2 });
+#endif
+    supported.push_back({ "scalar", quantizeScalar, scaleAndQuantizeScalar, accumulateRunsScalar, minMaxScalar, mapColorsScalar, accumulateRGBAScalar, accumulateRGBARunsScalar });
+    return supported;
+}
+
+const std::vector<Kernels> &availableKernels()
+{
+    static const std::vector<Kernels> available = supportedKernels();
+    return available;
+}
+
+// the selected kernels; the best available unless another instruction set is selected.
+std::atomic<const Kernels *> selected_kernels(nullptr);
+
+const Kernels &kernels()
+{
+    const Kernels *kernels = selected_kernels.load(std::memory_order_acquire);
+    return kernels ? *kernels : availableKernels().front();
+}
+
+// rows of non-float data are converted into a scratch row; float rows are used in place.
+// the conversions are simple loops that the compiler vectorizes.
+typedef const float *(*ReadRowFn)(const void *data, long row, long width, float *scratch);
+
+struct Complex64
+{
+    float real;
+    float imag;
+};
+
+template <typename T>
+const float *readRow(const void *data, long row, long width, float *scratch)
+{
+    const T *src = static_cast<const T *>(data) + row * width;
+    for (long i=0; i<width; ++i)
+        scratch[i] = float(src[i]);
+    return scratch;
+}
+
+template <>
+const float *readRow<float>(const void *data, long row, long width, float * /*scratch*/)
+{
+    return static_cast<const float *>(data) + row * width;
+}
+
+template <>
+const float *readRow<Complex64>(const void *data, long row, long width, float *scratch)
+{
+    const Complex64 *src = static_cast<const Complex64 *>(data) + row * width;
+    for (long i=0; i<width; ++i)
+        scratch[i] = sqrtf(src[i].real * src[i].real + src[i].imag * src[i].imag);
+    return scratch;
+}
+
+ReadRowFn rowReader(ImageKernels::DataType data_type)
+{
+    switch (data_type)
+    {
+        case ImageKernels::DataType_UInt8: return readRow<uint8_t>;
+        case ImageKernels::DataType_UInt16: return readRow<uint16_t>;
+        case ImageKernels::DataType_Int16: return readRow<int16_t>;
+        case ImageKernels::DataType_UInt32: return readRow<uint32_t>;
+        case ImageKernels::DataType_Int32: return readRow<int32_t>;
+        case ImageKernels::DataType_UInt64: return readRow<uint64_t>;
+        case ImageKernels::DataType_Int64: return readRow<int64_t>;
+        case ImageKernels::DataType_Float32: return readRow<float>;
+        case ImageKernels::DataType_Float64: return readRow<double>;
+        case ImageKernels::DataType_Complex64: return readRow<Complex64>;
+        default: return nullptr;
+    }
+}
+
+std::atomic<TaskRunner *> band_task_runner(nullptr);
+std::atomic<int> band_thread_count(0);
+
+// below this many source pixels a conversion is not worth splitting across threads.
+const long MINIMUM_PARALLEL_PIXELS = 512 * 512;
+
+// call fn(start, end) over bands covering [0, count), in parallel when a task runner is
+// available and the work is large enough. there are several bands per thread so that
+// threads which start late or run slowly do not hold up the result.
+void runBands(long count, long pixel_count, const std::function<void(long, long)> &fn)
+{
+    TaskRunner *task_runner = band_task_runner.load();
+    int thread_count = band_thread_count.load();
+    if (thread_count <= 0)
+        thread_count = std::max(1, int(std::thread::hardware_concurrency()));
+    const long band_count = std::min(count, long(thread_count) * 4);
+    if (!task_runner || thread_count <= 1 || band_count <= 1 || pixel_count < MINIMUM_PARALLEL_PIXELS)
+    {
+        fn(0, count);
+        return;
+    }
+    task_runner->run(int(band_count), thread_count, [&](int band) {
+        fn(count * band / band_count, count * (band + 1) / band_count);
+    });
+}
+
+// collect the row pointers up front; QImage::scanLine is not safe to call from several threads.
+std::vector<uint8_t *> scanLines(ImageInterface *image, long height)
+{
+    std::vector<uint8_t *> lines(height);
+    for (long row=0; row<height; ++row)
+        lines[row] = image->scanLine(row);
+    return lines;
+}
+
+inline float displayScale(float display_limit_low, float display_limit_high, int32_t max_index = 255)
+{
+    return display_limit_high != display_limit_low ? double(max_index) / (display_limit_high - display_limit_low) : 1;
+}
+
+}  // namespace
+
+void ImageKernels::setTaskRunner(TaskRunner *task_runner)
+{
+    band_task_runner = task_runner;
+}
+
+void ImageKernels::setThreadCount(int thread_count)
+{
+    band_thread_count = thread_count;
+}
+
+const char *ImageKernels::instructionSetName()
+{
+    return kernels().name;
+}
+
+std::vector<std::string> ImageKernels::instructionSetNames()
+{
+    std::vector<std::string> names;
+    for (const auto &available : availableKernels())
+        names.push_back(available.name);
+    return names;
+}
+
+bool ImageKernels::setInstructionSet(const char *name)
+{
+    for (const auto &available : availableKernels())
+    {
+        if (strcmp(available.name, name) == 0)
+        {
+            selected_kernels.store(&available, std::memory_order_release);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ImageKernels::quantizeFloatToIndexed8(const float *src, uint8_t *dst, long count, float low, float high, float m)
+{
+    kernels().quantize(src, dst, count, low, high, m);
+}
+
+ImageKernels::DataType ImageKernels::dataTypeFromFormat(const char *format, long item_size)
+{
+    // a missing format means unsigned bytes.
+    if (format == nullptr)
+        return item_size == 1 ? DataType_UInt8 : DataType_Unknown;
+
+    // native and little endian byte order prefixes are accepted; the supported platforms are all little endian.
+    if (*format == '@' || *format == '=' || *format == '<')
+        ++format;
+
+    const std::string code(format);
+    DataType data_type = DataType_Unknown;
+    long expected_size = 0;
+    if (code == "B")
+        { data_type = DataType_UInt8; expected_size = 1; }
+    else if (code == "H")
+        { data_type = DataType_UInt16; expected_size = 2; }
+    else if (code == "h")
+        { data_type = DataType_Int16; expected_size = 2; }
+    else if (code == "i" || (code == "l" && item_size == 4))
+        { data_type = DataType_Int32; expected_size = 4; }
+    else if (code == "I" || (code == "L" && item_size == 4))
+        { data_type = DataType_UInt32; expected_size = 4; }
+    else if (code == "q" || code == "l")
+        { data_type = DataType_Int64; expected_size = 8; }
+    else if (code == "Q" || code == "L")
+        { data_type = DataType_UInt64; expected_size = 8; }
+    else if (code == "f")
+        { data_type = DataType_Float32; expected_size = 4; }
+    else if (code == "d")
+        { data_type = DataType_Float64; expected_size = 8; }
+    else if (code == "Zf")
+        { data_type = DataType_Complex64; expected_size = 8; }
+
+    // "l" and "L" are 32 or 64 bits depending on the platform; the item size tells which.
+    return item_size == expected_size ? data_type : DataType_Unknown;
+}
+
+namespace {
+
+// writes rows of display pixels for the conversions below: one byte per pixel for indexed images,
+// quantized by the display limits.
+struct Indexed8Writer
+{
+    const Kernels &k;
+    float low;
+    float high;
+    float m;
+
+    static const ImageFormat format = ImageFormat::Format_Indexed8;
+
+    void write(const float *src, uint8_t *dst, long count) const { k.quantize(src, dst, count, low, high, m); }
+    void writeScaled(const float *src, uint8_t *dst, long count, float scale) const { k.scaleAndQuantize(src, dst, count, scale, low, high, m); }
+    void clear(uint8_t *dst, long count) const { memset(dst, 0, count); }
+};
+
+// writes rows of premultiplied ARGB32 pixels through a lookup table of max_index + 1 entries. with 256 entries,
+// the colors are those of the indexed image with the same table.
+struct ARGB32Writer
+{
+    const Kernels &k;
+    float low;
+    float high;
+    float m;
+    const uint32_t *lookup_table;
+    int32_t max_index;
+
+    static const ImageFormat format = ImageFormat::Format_ARGB32_Premultiplied;
+
+    void write(const float *src, uint8_t *dst, long count) const { writeScaled(src, dst, count, 1.0f); }
+    void writeScaled(const float *src, uint8_t *dst, long count, float scale) const { k.mapColors(src, reinterpret_cast<uint32_t *>(dst), count, scale, low, high, m, lookup_table, max_index); }
+    void clear(uint8_t *dst, long count) const { std::fill_n(reinterpret_cast<uint32_t *>(dst), count, lookup_table[0]); }
+};
+
+template <typename Writer>
+void writeArray(const void *data, ImageKernels::DataType data_type, long width, long height, const Writer &writer, ImageInterface *image)
+{
+    const ReadRowFn read_row = rowReader(data_type);
+    if (!read_row)
+        return;
+
+    image->create((unsigned int)width, (unsigned int)height, Writer::format);
+    const std::vector<uint8_t *> dst_lines = scanLines(image, height);
+
+    runBands(height, width * height, [&](long row_start, long row_end) {
+        std::vector<float> scratch(data_type != ImageKernels::DataType_Float32 ? width : 0);
+        for (long row=row_start; row<row_end; ++row)
+            writer.write(read_row(data, row, width, scratch.data()), dst_lines[row], width);
+    });
+}
+
+template <typename Writer>
+void writeDownsampledArray(const void *data, ImageKernels::DataType data_type, long width, long height, long dest_width, long dest_height, const Writer &writer, ImageInterface *image)
+{
+    const ReadRowFn read_row = rowReader(data_type);
+    if (!read_row)
+        return;
+
+    const Kernels &k = kernels();
+
+    image->create((unsigned int)dest_width, (unsigned int)dest_height, Writer::format);
+    const std::vector<uint8_t *> dst_lines = scanLines(image, dest_height);
+
+    // each column run is summed into the next entry of the line buffer and each row run
+    // is written to the destination row of its first source row. these only differ from
+    // the run index when the image is being enlarged along that axis.
+    const Runs columns(width, dest_width);
+    const Runs rows(height, dest_height);
+    const long column_count = std::min(columns.size(), dest_width);
+
+    // rows skipped when enlarging are cleared rather than left uninitialized.
+    long row_count = 0;
+    long next_dst_row = 0;
+    for (; row_count < rows.size() && rows.indexes[row_count] < dest_height; ++row_count)
+    {
+        for (; next_dst_row < rows.indexes[row_count]; ++next_dst_row)
+            writer.clear(dst_lines[next_dst_row], dest_width);
+        next_dst_row = rows.indexes[row_count] + 1;
+    }
+    for (; next_dst_row < dest_height; ++next_dst_row)
+        writer.clear(dst_lines[next_dst_row], dest_width);
+
+    // row runs are independent, so bands of row runs are rendered in parallel.
+    runBands(row_count, width * height, [&](long r_start, long r_end) {
+        std::vector<float> scratch(data_type != ImageKernels::DataType_Float32 ? width : 0);
+        std::vector<float> line(dest_width);
+        for (long r=r_start; r<r_end; ++r)
+        {
+            std::fill(line.begin(), line.end(), 0.0f);
+
+            const long row_start = rows.starts[r];
+            const long row_end = row_start + rows.lengths[r];
+            for (long row=row_start; row<row_end; ++row)
+                k.accumulateRuns(read_row(data, row, width, scratch.data()), columns.starts.data(), columns.lengths.data(), column_count, columns.max_length, line.data());
+
+            const float mm = 1.0 / rows.lengths[r];
+            writer.writeScaled(line.data(), dst_lines[rows.indexes[r]], dest_width, mm);
+        }
+    });
+}
+
+}  // namespace
+
+void ImageKernels::arrayToIndexed8(const void *data, DataType data_type, long width, long height, float display_limit_low, float display_limit_high, ImageInterface *image)
+{
+    const Indexed8Writer writer{kernels(), display_limit_low, display_limit_high, displayScale(display_limit_low, display_limit_high)};
+    writeArray(data, data_type, width, height, writer, image);
+}
+
+void ImageKernels::downsampledArrayToIndexed8(const void *data, DataType data_type, long width, long height, long dest_width, long dest_height, float display_limit_low, float display_limit_high, ImageInterface *image)
+{
+    const Indexed8Writer writer{kernels(), display_limit_low, display_limit_high, displayScale(display_limit_low, display_limit_high)};
+    writeDownsampledArray(data, data_type, width, height, dest_width, dest_height, writer, image);
+}
+
+void ImageKernels::mapFloatToARGB32(const float *src, uint32_t *dst, long count, float scale, float low, float high, float m, const uint32_t *lookup_table, int32_t max_index)
+{
+    kernels().mapColors(src, dst, count, scale, low, high, m, lookup_table, max_index);
+}
+
+void ImageKernels::arrayToARGB32(const void *data, DataType data_type, long width, long height, float display_limit_low, float display_limit_high, const uint32_t *lookup_table, long lookup_table_size, ImageInterface *image)
+{
+    if (lookup_table_size < 1)
+        return;
+    const int32_t max_index = int32_t(lookup_table_size - 1);
+    const ARGB32Writer writer{kernels(), display_limit_low, display_limit_high, displayScale(display_limit_low, display_limit_high, max_index), lookup_table, max_index};
+    writeArray(data, data_type, width, height, writer, image);
+}
+
+void ImageKernels::downsampledArrayToARGB32(const void *data, DataType data_type, long width, long height, long dest_width, long dest_height, float display_limit_low, float display_limit_high, const uint32_t *lookup_table, long lookup_table_size, ImageInterface *image)
+{
+    if (lookup_table_size < 1)
+        return;
+    const int32_t max_index = int32_t(lookup_table_size - 1);
+    const ARGB32Writer writer{kernels(), display_limit_low, display_limit_high, displayScale(display_limit_low, display_limit_high, max_index), lookup_table, max_index};
+    writeDownsampledArray(data, data_type, width, height, dest_width, dest_height, writer, image);
+}
+
+namespace {
+
+// lookup tables have 256 to MAXIMUM_LOOKUP_TABLE_SIZE ARGB entries; extra entries are ignored.
+const long MAXIMUM_LOOKUP_TABLE_SIZE = 65536;
+
+long lookupTableSize(const ImageKernels::ImageBuffer *lookup_table)
+{
+    if (lookup_table && lookup_table->isValid() && lookup_table->item_size == 4 && lookup_table->length >= 256 * 4)
+        return std::min(lookup_table->length / 4, MAXIMUM_LOOKUP_TABLE_SIZE);
+    return 0;
+}
+
+// the 256 entry color table of an indexed image. larger lookup tables are sampled evenly, including both ends.
+std::vector<unsigned int> colorTable(const ImageKernels::ImageBuffer *lookup_table)
+{
+    std::vector<unsigned int> color_table;
+    const long lookup_table_size = lookupTableSize(lookup_table);
+    if (lookup_table_size > 0)
+    {
+        const uint32_t *entries = static_cast<const uint32_t *>(lookup_table->data);
+        for (long i=0; i<256; ++i)
+            color_table.push_back(entries[i * (lookup_table_size - 1) / 255]);
+    }
+    else
+    {
+        for (int i=0; i<256; ++i)
+            color_table.push_back(0xFF << 24 | i << 16 | i << 8 | i);
+    }
+    return color_table;
+}
+
+// premultiply an ARGB color the way QImage does when converting to Format_ARGB32_Premultiplied.
+inline uint32_t premultiply(uint32_t x)
+{
+    const uint32_t a = x >> 24;
+    uint32_t t = (x & 0xff00ff) * a;
+    t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+    t &= 0xff00ff;
+    x = ((x >> 8) & 0xff) * a;
+    x = (x + ((x >> 8) & 0xff) + 0x80);
+    x &= 0xff00;
+    return x | t | (a << 24);
+}
+
+// the premultiplied colors of a lookup table at its full resolution, or gray scale if there is none.
+std::vector<uint32_t> premultipliedLookupTable(const ImageKernels::ImageBuffer *lookup_table)
+{
+    std::vector<uint32_t> colors;
+    const long lookup_table_size = lookupTableSize(lookup_table);
+    if (lookup_table_size > 0)
+    {
+        const uint32_t *entries = static_cast<const uint32_t *>(lookup_table->data);
+        colors.resize(lookup_table_size);
+        for (long i=0; i<lookup_table_size; ++i)
+            colors[i] = premultiply(entries[i]);
+    }
+    else
+    {
+        for (uint32_t i=0; i<256; ++i)
+            colors.push_back(0xFFu << 24 | i << 16 | i << 8 | i);
+    }
+    return colors;
+}
+
+// whether an array is downsampled to fit width x height scaled by context scaling.
+bool isDownsampled(const ImageKernels::ImageBuffer &array, float width, float height, float context_scaling)
+{
+    const long dest_width = width * context_scaling;
+    const long dest_height = height * context_scaling;
+    return (width * context_scaling < array.width * 0.75 || height * context_scaling < array.height * 0.75) && (dest_width > 0 && dest_height > 0);
+}
+
+}  // namespace
+
+void ImageKernels::imageFromRGBA(const ImageBuffer &array, ImageInterface *image)
+{
+    const long width = array.width;
+    const long height = array.height;
+    if (!array.isValid() || array.length < width * height * 4)
+        return;
+    image->create((unsigned int)width, (unsigned int)height, ImageFormat::Format_ARGB32);
+    for (long row=0; row<height; ++row)
+        memcpy(image->scanLine(row), static_cast<const uint32_t *>(array.data) + row * width, width * sizeof(uint32_t));
+}
+
+void ImageKernels::scaledImageFromRGBA(const ImageBuffer &array, long width, long height, ImageInterface *image)
+{
+    const long src_width = array.width;
+    const long src_height = array.height;
+    if (!array.isValid() || array.length < src_width * src_height * 4 || src_width <= 0 || src_height <= 0)
+        return;
+
+    // fit the source into width x height, keeping its aspect ratio, like QSize::scaled with Qt::KeepAspectRatio.
+    long dest_width = long(int64_t(height) * src_width / src_height);
+    long dest_height = height;
+    if (dest_width > width)
+    {
+        dest_width = width;
+        dest_height = long(int64_t(width) * src_height / src_width);
+    }
+
+    if (dest_width <= 0 || dest_height <= 0 || (dest_width >= src_width * 0.75 && dest_height >= src_height * 0.75))
+    {
+        imageFromRGBA(array, image);
+        return;
+    }
+
+    dest_width = std::min(dest_width, src_width);
+    dest_height = std::min(dest_height, src_height);
+
+    const Kernels &k = kernels();
+    const uint32_t *data = static_cast<const uint32_t *>(array.data);
+
+    image->create((unsigned int)dest_width, (unsigned int)dest_height, ImageFormat::Format_ARGB32_Premultiplied);
+    const std::vector<uint8_t *> dst_lines = scanLines(image, dest_height);
+
+    // each destination pixel is the average of the premultiplied source pixels in its runs of rows and columns.
+    // the rows of a run are summed per source column, then the columns of each run are summed per channel.
+    const Runs columns(src_width, dest_width);
+    const Runs rows(src_height, dest_height);
+    const long column_count = std::min(columns.size(), dest_width);
+
+    // the image is not enlarged, so every destination row and column has a run. guard against rounding anyway.
+    long row_count = 0;
+    while (row_count < rows.size() && rows.indexes[row_count] < dest_height)
+        ++row_count;
+    for (long row=0; row<dest_height; ++row)
+    {
+        if (row >= row_count || rows.indexes[row] != row)
+            memset(dst_lines[row], 0, dest_width * 4);
+    }
+
+    runBands(row_count, src_width * src_height, [&](long r_start, long r_end) {
+        std::vector<uint32_t> sums(src_width * 4);
+        std::vector<float> line(dest_width * 4);
+        for (long r=r_start; r<r_end; ++r)
+        {
+            std::fill(line.begin(), line.end(), 0.0f);
+
+            const long row_start = rows.starts[r];
+            const long row_end = row_start + rows.lengths[r];
+            for (long chunk_start=row_start; chunk_start<row_end; chunk_start+=RGBA_ROW_CHUNK)
+            {
+                std::fill(sums.begin(), sums.end(), 0);
+                const long chunk_end = std::min(chunk_start + RGBA_ROW_CHUNK, row_end);
+                for (long row=chunk_start; row<chunk_end; ++row)
+                    k.accumulateRGBA(data + row * src_width, sums.data(), src_width);
+                k.accumulateRGBARuns(sums.data(), columns.starts.data(), columns.lengths.data(), column_count, line.data());
+            }
+
+            // the sums are scaled by 255 for each pixel. channels are rounded to the nearest value; the color
+            // channels do not exceed alpha since each term of their sums does not exceed the alpha term.
+            uint32_t *dst = reinterpret_cast<uint32_t *>(dst_lines[rows.indexes[r]]);
+            const float row_scale = 1.0f / (255.0f * rows.lengths[r]);
+            for (long column=0; column<column_count; ++column)
+            {
+                const float scale = row_scale / columns.lengths[column];
+                const float *channels = line.data() + column * 4;
+                const uint32_t blue = uint32_t(channels[0] * scale + 0.5f);
+                const uint32_t green = uint32_t(channels[1] * scale + 0.5f);
+                const uint32_t red = uint32_t(channels[2] * scale + 0.5f);
+                const uint32_t alpha = std::min(uint32_t(channels[3] * scale + 0.5f), 255u);
+                dst[column] = alpha << 24 | std::min(red, alpha) << 16 | std::min(green, alpha) << 8 | std::min(blue, alpha);
+            }
+            std::fill(dst + column_count, dst + dest_width, 0);
+        }
+    });
+}
+
+void ImageKernels::imageFromArray(const ImageBuffer &array, float display_limit_low, float display_limit_high, const ImageBuffer *lookup_table, ImageInterface *image)
+{
+    if (!array.isValid())
+        return;
+    arrayToIndexed8(array.data, array.data_type, array.width, array.height, display_limit_low, display_limit_high, image);
+    image->setColorTable(colorTable(lookup_table));
+}
+
+void ImageKernels::scaledImageFromArray(const ImageBuffer &array, float width_, float height_, float context_scaling, float display_limit_low, float display_limit_high, const ImageBuffer *lookup_table, ImageInterface *image)
+{
+    if (!array.isValid())
+        return;
+
+    const long width = array.width;
+    const long height = array.height;
+    const long dest_width = width_ * context_scaling;
+    const long dest_height = height_ * context_scaling;
+
+    if (isDownsampled(array, width_, height_, context_scaling))
+        downsampledArrayToIndexed8(array.data, array.data_type, width, height, dest_width, dest_height, display_limit_low, display_limit_high, image);
+    else
+        arrayToIndexed8(array.data, array.data_type, width, height, display_limit_low, display_limit_high, image);
+
+    image->setColorTable(colorTable(lookup_table));
+}
+
+void ImageKernels::scaledImageFromArrayARGB32(const ImageBuffer &array, float width_, float height_, float context_scaling, float display_limit_low, float display_limit_high, const ImageBuffer *lookup_table, ImageInterface *image)
+{
+    if (!array.isValid())
+        return;
+
+    const long width = array.width;
+    const long height = array.height;
+    const long dest_width = width_ * context_scaling;
+    const long dest_height = height_ * context_scaling;
+
+    const std::vector<uint32_t> colors = premultipliedLookupTable(lookup_table);
+
+    if (isDownsampled(array, width_, height_, context_scaling))
+        downsampledArrayToARGB32(array.data, array.data_type, width, height, dest_width, dest_height, display_limit_low, display_limit_high, colors.data(), long(colors.size()), image);
+    else
+        arrayToARGB32(array.data, array.data_type, width, height, display_limit_low, display_limit_high, colors.data(), long(colors.size()), image);
+}
+
+void ImageKernels::minMaxEnvelope(const ImageBuffer &array, int64_t first, int64_t count, long columns, float *minimums, float *maximums)
+{
+    const ReadRowFn read_row = rowReader(array.data_type);
+    if (!array.isValid() || !read_row || columns <= 0)
+        return;
+
+    // restrict the range to the samples of the array.
+    const int64_t sample_count = int64_t(array.width) * array.height;
+    const int64_t range_start = std::max(int64_t(0), std::min(first, sample_count));
+    const int64_t range_end = std::max(range_start, std::min(first + std::max(count, int64_t(0)), sample_count));
+    const int64_t range_count = range_end - range_start;
+
+    const Kernels &k = kernels();
+    const uint8_t *data = static_cast<const uint8_t *>(array.data);
+
+    // values are read in chunks so that the scratch buffer for non-float data stays small.
+    const int64_t chunk_size = 4096;
+
+    runBands(columns, long(std::min(range_count, int64_t(LONG_MAX))), [&](long column_start, long column_end) {
+        std::vector<float> scratch(array.data_type != DataType_Float32 ? chunk_size : 0);
+        for (long column=column_start; column<column_end; ++column)
+        {
+            const int64_t start = range_start + range_count * column / columns;
+            const int64_t end = range_start + range_count * (column + 1) / columns;
+            float mn = INFINITY;
+            float mx = -INFINITY;
+            for (int64_t i=start; i<end; i+=chunk_size)
+            {
+                const long n = long(std::min(chunk_size, end - i));
+                k.minMax(read_row(data + i * array.item_size, 0, n, scratch.data()), n, &mn, &mx);
+            }
+            minimums[column] = mn <= mx ? mn : NAN;
+            maximums[column] = mn <= mx ? mx : NAN;
+        }
+    });
+}
+
+void ImageKernels::readFloats(const ImageBuffer &array, int64_t first, int64_t count, float *values)
+{
+    const ReadRowFn read_row = rowReader(array.data_type);
+    if (!array.isValid() || !read_row || first < 0 || count <= 0 || first + count > int64_t(array.width) * array.height)
+        return;
+
+    const uint8_t *data = static_cast<const uint8_t *>(array.data);
+
+    // read in chunks that fit in a long; the row reader converts into the destination directly.
+    const int64_t chunk_size = 1 << 20;
+    for (int64_t i=0; i<count; i+=chunk_size)
+    {
+        const long n = long(std::min(chunk_size, count - i));
+        const float *row = read_row(data + (first + i) * array.item_size, 0, n, values + i);
+        if (row != values + i)
+            memcpy(values + i, row, n * sizeof(float));
+    }
+}
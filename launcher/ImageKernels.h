@@ -0,0 +1,121 @@
+#ifndef IMAGEKERNELS_H
+#define IMAGEKERNELS_H
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Image.h"
+#include "TaskRunner.h"
+
+/*
+ Pixel kernels used to convert array data to display images.
+
+ The kernels have a scalar implementation and SSE2/AVX2 implementations on x86-64. The
+ implementation is chosen once at run time based on the capabilities of the processor. All
+ implementations produce bit-identical results: the vector versions evaluate the same float
+ operations in the same order per output pixel as the scalar version.
+*/
+
+namespace ImageKernels
+{
+    // element types of array data accepted by the conversions. complex values are displayed by magnitude.
+    enum DataType
+    {
+        DataType_Unknown,
+        DataType_UInt8,
+        DataType_UInt16,
+        DataType_Int16,
+        DataType_UInt32,
+        DataType_Int32,
+        DataType_UInt64,
+        DataType_Int64,
+        DataType_Float32,
+        DataType_Float64,
+        DataType_Complex64,
+    };
+
+    // the data type for a buffer protocol format string (numpy style, native byte order) and item size.
+    DataType dataTypeFromFormat(const char *format, long item_size);
+
+    // a contiguous view of array data. for arrays with more than two dimensions, the trailing
+    // dimensions are part of each pixel (e.g. height x width x 4 bytes for RGBA). the data stays
+    // valid as long as a copy of the owner exists; the owner releases the underlying buffer.
+    struct ImageBuffer
+    {
+        const void *data = nullptr;
+        const void *source = nullptr;  // identity of the object that exported the data
+        long width = 0;
+        long height = 0;
+        long item_size = 0;
+        long length = 0;  // bytes
+        DataType data_type = DataType_Unknown;
+        std::shared_ptr<void> owner;
+
+        bool isValid() const { return data != nullptr; }
+    };
+
+    // convert an RGBA (uint32) array to an ARGB32 image.
+    void imageFromRGBA(const ImageBuffer &array, ImageInterface *image);
+
+    // like imageFromRGBA, but fit to width x height keeping the aspect ratio, if that is substantially smaller than the
+    // array. the smaller image is premultiplied ARGB32 and each pixel is the average of the source pixels it covers.
+    void scaledImageFromRGBA(const ImageBuffer &array, long width, long height, ImageInterface *image);
+
+    // convert an array to an indexed image using the display limits and an ARGB lookup table (or gray scale if null).
+    // lookup tables have 256 or more entries; larger tables are sampled to 256 entries.
+    void imageFromArray(const ImageBuffer &array, float display_limit_low, float display_limit_high, const ImageBuffer *lookup_table, ImageInterface *image);
+
+    // like imageFromArray, but downsample to width x height scaled by context_scaling if that is substantially smaller than the array.
+    void scaledImageFromArray(const ImageBuffer &array, float width, float height, float context_scaling, float display_limit_low, float display_limit_high, const ImageBuffer *lookup_table, ImageInterface *image);
+
+    // like scaledImageFromArray, but write a premultiplied ARGB32 image through the lookup table directly, so that
+    // the image does not have to be converted when it is drawn. lookup tables of up to 65536 entries (e.g. 4096)
+    // are used at full resolution.
+    void scaledImageFromArrayARGB32(const ImageBuffer &array, float width, float height, float context_scaling, float display_limit_low, float display_limit_high, const ImageBuffer *lookup_table, ImageInterface *image);
+
+    // large conversions are split into bands of rows and run on the task runner, if one is set.
+    // the task runner must remain valid while conversions are running.
+    void setTaskRunner(TaskRunner *task_runner);
+
+    // the maximum number of threads used for one conversion. zero or less uses all processors.
+    void setThreadCount(int thread_count);
+
+    // the name of the instruction set used by the kernels ("scalar", "sse2", "avx2").
+    const char *instructionSetName();
+
+    // the names of the instruction sets supported by the processor, best first. the last is "scalar".
+    std::vector<std::string> instructionSetNames();
+
+    // use the kernels of a supported instruction set instead of the best one, for instance to compare them with the
+    // scalar kernels. returns false if the instruction set is not supported. not to be called during conversions.
+    bool setInstructionSet(const char *name);
+
+    // map float values to display bytes: v < low -> 0, v > high -> 255, otherwise (v - low) * m truncated.
+    void quantizeFloatToIndexed8(const float *src, uint8_t *dst, long count, float low, float high, float m);
+
+    // map an array to an indexed image, one pixel per value. values are converted to float before mapping.
+    void arrayToIndexed8(const void *data, DataType data_type, long width, long height, float display_limit_low, float display_limit_high, ImageInterface *image);
+
+    // map an array to a smaller indexed image by averaging the source pixels in each destination pixel.
+    void downsampledArrayToIndexed8(const void *data, DataType data_type, long width, long height, long dest_width, long dest_height, float display_limit_low, float display_limit_high, ImageInterface *image);
+
+    // map float values multiplied by scale through a lookup table of max_index + 1 colors: v < low -> the first
+    // color, v > high -> the last color, otherwise the color at (v - low) * m truncated. NaN maps to the first color.
+    void mapFloatToARGB32(const float *src, uint32_t *dst, long count, float scale, float low, float high, float m, const uint32_t *lookup_table, int32_t max_index);
+
+    // like arrayToIndexed8 and downsampledArrayToIndexed8, but write the colors of a premultiplied lookup table to a premultiplied ARGB32 image.
+    void arrayToARGB32(const void *data, DataType data_type, long width, long height, float display_limit_low, float display_limit_high, const uint32_t *lookup_table, long lookup_table_size, ImageInterface *image);
+    void downsampledArrayToARGB32(const void *data, DataType data_type, long width, long height, long dest_width, long dest_height, float display_limit_low, float display_limit_high, const uint32_t *lookup_table, long lookup_table_size, ImageInterface *image);
+
+    // the minimum and maximum of the samples [first, first + count) of an array, treated as one dimensional, split
+    // into columns equal runs. the range is clipped to the array. NaN values are skipped; the minimum and maximum
+    // of a column without values are NaN. with as many columns as samples, this reads the samples as floats.
+    void minMaxEnvelope(const ImageBuffer &array, int64_t first, int64_t count, long columns, float *minimums, float *maximums);
+
+    // read the values [first, first + count) of an array, treated as one dimensional, as floats. the range must be within the array.
+    void readFloats(const ImageBuffer &array, int64_t first, int64_t count, float *values);
+}
+
+#endif
@@ -9,17 +9,24 @@ SOURCES +=\
     main.cpp \
     DocumentWindow.cpp \
     Application.cpp \
+    CanvasTrace.cpp \
+    ImageKernels.cpp \
     PythonSelectDialog.cpp \
     PythonStubs.cpp \
-    PythonSupport.cpp
+    PythonSupport.cpp \
+    Telemetry.cpp
 
 HEADERS  += \
     DocumentWindow.h \
     Application.h \
+    CanvasTrace.h \
     Image.h \
+    ImageKernels.h \
     PythonSelectDialog.h \
     PythonStubs.h \
-    PythonSupport.h
+    PythonSupport.h \
+    TaskRunner.h \
+    Telemetry.h
 
 RESOURCES += \
     resources.qrc
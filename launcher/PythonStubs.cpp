@@ -6,6 +6,7 @@
 #if !defined(Q_OS_WIN)
 #include <dlfcn.h>
 #define LOOKUP_SYMBOL dlsym
+#define LOOKUP_OPTIONAL_SYMBOL dlsym
 #else
 #include <Windows.h>
 #include <WinBase.h>
@@ -15,6 +16,11 @@ void *LOOKUP_SYMBOL(void *h, const char *proc)
     Q_ASSERT(addr != 0);
     return addr;
 }
+// for symbols that are not in all supported Python versions.
+void *LOOKUP_OPTIONAL_SYMBOL(void *h, const char *proc)
+{
+    return GetProcAddress(HMODULE(h), proc);
+}
 #endif
 
 #pragma push_macro("_DEBUG")
@@ -32,8 +38,10 @@ typedef int (*PyCallable_CheckFn)(PyObject *o);
 typedef void* (*PyCapsule_GetPointerFn)(PyObject *capsule, const char *name);
 typedef int (*PyCapsule_IsValidFn)(PyObject *capsule, const char *name);
 typedef PyObject* (*PyCapsule_NewFn)(void *pointer, const char *name, PyCapsule_Destructor destructor);
+typedef PyObject* (*PyDict_GetItemFn)(PyObject *p, PyObject *key);
 typedef PyObject* (*PyDict_GetItemStringFn)(PyObject *p, const char *key);
 typedef PyObject* (*PyDict_NewFn)();
+typedef int (*PyDict_NextFn)(PyObject *p, Py_ssize_t *ppos, PyObject **pkey, PyObject **pvalue);
 typedef int (*PyDict_SetItemFn)(PyObject *p, PyObject *key, PyObject *val);
 typedef void (*PyErr_ClearFn)();
 typedef PyObject* (*PyErr_FormatFn)(PyObject *exception, const char *format, ...);
@@ -72,10 +80,12 @@ typedef PyObject* (*PyModule_GetDictFn)(PyObject *module);
 typedef PyObject* (*PyObject_CallObjectFn)(PyObject *callable_object, PyObject *args);
 typedef PyObject* (*PyObject_GetAttrFn)(PyObject *o, PyObject *attr_name);
 typedef PyObject* (*PyObject_GetAttrStringFn)(PyObject *o, const char *attr_name);
+typedef PyObject* (*PyObject_GenericGetDictFn)(PyObject *o, void *context);
 typedef int (*PyObject_GetBufferFn)(PyObject *o, Py_buffer *view, int flags);
 typedef int (*PyObject_HasAttrStringFn)(PyObject *o, const char *attr_name);
 typedef int (*PyObject_IsTrueFn)(PyObject *o);
 typedef int (*PyObject_SetAttrFn)(PyObject *o, PyObject *attr_name, PyObject *v);
+typedef PyObject* (*PyObject_VectorcallFn)(PyObject *callable, PyObject *const *args, size_t nargsf, PyObject *kwnames);
 typedef PyObject* (*PyRun_SimpleStringFn)(const char *str);
 typedef PyObject* (*PyRun_StringFlagsFn)(const char *str, int start, PyObject *globals, PyObject *locals, PyCompilerFlags *flags);
 typedef int (*PySequence_CheckFn)(PyObject *o);
@@ -90,6 +100,10 @@ typedef int (*PyType_IsSubtypeFn)(PyTypeObject *a, PyTypeObject *b);
 typedef char* (*PyUnicode_AsUTF8Fn)(PyObject *unicode);
 typedef PyObject* (*PyUnicode_DecodeUTF16Fn)(const char *s, Py_ssize_t size, const char *errors, int *byteorder);
 typedef PyObject *(*PyUnicode_FromStringFn)(const char *u);
+typedef PyObject *(*PyUnicode_InternFromStringFn)(const char *u);
+typedef PyObject *(*PyWeakref_GetObjectFn)(PyObject *ref);
+typedef int (*PyWeakref_GetRefFn)(PyObject *ref, PyObject **pobj);
+typedef PyObject *(*PyWeakref_NewRefFn)(PyObject *ob, PyObject *callback);
 typedef wchar_t *(*PyUnicode_AsWideCharStringFn)(PyObject *unicode, Py_ssize_t *size);
 typedef void (*PyMem_FreeFn)(void *p);
 typedef PyObject* (*Py_CompileStringExFlagsFn)(const char *str, const char *filename, int start, PyCompilerFlags *flags, int optimize);
@@ -104,8 +118,10 @@ static PyCallable_CheckFn fCallable_Check = 0;
 static PyCapsule_GetPointerFn fCapsule_GetPointer = 0;
 static PyCapsule_IsValidFn fCapsule_IsValid = 0;
 static PyCapsule_NewFn fCapsule_New = 0;
+static PyDict_GetItemFn fDict_GetItem = 0;
 static PyDict_GetItemStringFn fDict_GetItemString = 0;
 static PyDict_NewFn fDict_New = 0;
+static PyDict_NextFn fDict_Next = 0;
 static PyDict_SetItemFn fDict_SetItem = 0;
 static PyErr_ClearFn fErr_Clear = 0;
 static PyErr_FormatFn fErr_Format = 0;
@@ -144,10 +160,13 @@ static PyModule_GetDictFn fModule_GetDict = 0;
 static PyObject_CallObjectFn fObject_CallObject = 0;
 static PyObject_GetAttrFn fObject_GetAttr = 0;
 static PyObject_GetAttrStringFn fObject_GetAttrString = 0;
+static PyObject_GenericGetDictFn fObject_GenericGetDict = 0;
 static PyObject_GetBufferFn fObject_GetBuffer = 0;
 static PyObject_HasAttrStringFn fObject_HasAttrString = 0;
 static PyObject_IsTrueFn fObject_IsTrue = 0;
 static PyObject_SetAttrFn fObject_SetAttr = 0;
+static PyObject_VectorcallFn fObject_Vectorcall = 0;
+static bool fObject_VectorcallLookedUp = false;
 static PyRun_SimpleStringFn fRun_SimpleString = 0;
 static PyRun_StringFlagsFn fRun_StringFlags = 0;
 static PySequence_CheckFn fSequence_Check = 0;
@@ -162,6 +181,11 @@ static PyType_IsSubtypeFn fType_IsSubtype = 0;
 static PyUnicode_AsUTF8Fn fUnicode_AsUTF8 = 0;
 static PyUnicode_DecodeUTF16Fn fUnicode_DecodeUTF16 = 0;
 static PyUnicode_FromStringFn fUnicode_FromString = 0;
+static PyUnicode_InternFromStringFn fUnicode_InternFromString = 0;
+static PyWeakref_GetObjectFn fWeakref_GetObject = 0;
+static PyWeakref_GetRefFn fWeakref_GetRef = 0;
+static bool fWeakref_GetRefLookedUp = false;
+static PyWeakref_NewRefFn fWeakref_NewRef = 0;
 static PyUnicode_AsWideCharStringFn fUnicode_AsWideCharString = 0;
 static PyMem_FreeFn fMem_Free = 0;
 static Py_CompileStringExFlagsFn fCompileStringExFlags = 0;
@@ -185,8 +209,10 @@ void deinitialize_pylib()
     fCapsule_GetPointer = 0;
     fCapsule_IsValid = 0;
     fCapsule_New = 0;
+    fDict_GetItem = 0;
     fDict_GetItemString = 0;
     fDict_New = 0;
+    fDict_Next = 0;
     fDict_SetItem = 0;
     fErr_Clear = 0;
     fErr_Format = 0;
@@ -225,6 +251,7 @@ void deinitialize_pylib()
     fObject_CallObject = 0;
     fObject_GetAttr = 0;
     fObject_GetAttrString = 0;
+    fObject_GenericGetDict = 0;
     fObject_GetBuffer = 0;
     fObject_HasAttrString = 0;
     fObject_IsTrue = 0;
@@ -243,6 +270,13 @@ void deinitialize_pylib()
     fUnicode_AsUTF8 = 0;
     fUnicode_DecodeUTF16 = 0;
     fUnicode_FromString = 0;
+    fUnicode_InternFromString = 0;
+    fWeakref_GetObject = 0;
+    fWeakref_GetRef = 0;
+    fWeakref_GetRefLookedUp = false;
+    fWeakref_NewRef = 0;
+    fObject_Vectorcall = 0;
+    fObject_VectorcallLookedUp = false;
     fCompileStringExFlags = 0;
     fInitialize = 0;
     fFinalize = 0;
@@ -267,6 +301,12 @@ bool DPyFloat_Check(PyObject *o)
     return Py_TYPE(o) == DPyFloat_Type;
 }
 
+bool DPyMethod_Check(PyObject *o)
+{
+    PyTypeObject *DPyMethod_Type = (PyTypeObject *)LOOKUP_SYMBOL(pylib, "PyMethod_Type");
+    return Py_TYPE(o) == DPyMethod_Type;
+}
+
 bool DPyModule_Check(PyObject *o)
 {
     PyTypeObject *DPyModule_Type = (PyTypeObject *)LOOKUP_SYMBOL(pylib, "PyModule_Type");
@@ -343,6 +383,13 @@ PyObject* DPyCapsule_New(void *pointer, const char *name, PyCapsule_Destructor d
     return fCapsule_New(pointer, name, destructor);
 }
 
+PyObject* DPyDict_GetItem(PyObject *p, PyObject *key)
+{
+    if (fDict_GetItem == 0)
+        fDict_GetItem = (PyDict_GetItemFn)LOOKUP_SYMBOL(pylib, "PyDict_GetItem");
+    return fDict_GetItem(p, key);
+}
+
 PyObject* DPyDict_GetItemString(PyObject *p, const char *key)
 {
     if (fDict_GetItemString == 0)
@@ -357,6 +404,13 @@ PyObject* DPyDict_New()
     return fDict_New();
 }
 
+int DPyDict_Next(PyObject *p, Py_ssize_t *ppos, PyObject **pkey, PyObject **pvalue)
+{
+    if (fDict_Next == 0)
+        fDict_Next = (PyDict_NextFn)LOOKUP_SYMBOL(pylib, "PyDict_Next");
+    return fDict_Next(p, ppos, pkey, pvalue);
+}
+
 int DPyDict_SetItem(PyObject *p, PyObject *key, PyObject *val)
 {
     if (fDict_SetItem == 0)
@@ -616,6 +670,13 @@ PyObject* DPyObject_GetAttr(PyObject *o, PyObject *attr_name)
     return fObject_GetAttr(o, attr_name);
 }
 
+PyObject* DPyObject_GenericGetDict(PyObject *o, void *context)
+{
+    if (fObject_GenericGetDict == 0)
+        fObject_GenericGetDict = (PyObject_GenericGetDictFn)LOOKUP_SYMBOL(pylib, "PyObject_GenericGetDict");
+    return fObject_GenericGetDict(o, context);
+}
+
 PyObject* DPyObject_GetAttrString(PyObject *o, const char *attr_name)
 {
     if (fObject_GetAttrString == 0)
@@ -651,6 +712,30 @@ int DPyObject_SetAttr(PyObject *o, PyObject *attr_name, PyObject *v)
     return fObject_SetAttr(o, attr_name, v);
 }
 
+PyObject* DPyObject_Vectorcall(PyObject *callable, PyObject *const *args, size_t nargsf, PyObject *kwnames)
+{
+    // PyObject_Vectorcall is exported from Python 3.9. earlier versions call with a tuple of the arguments.
+    if (!fObject_VectorcallLookedUp)
+    {
+        fObject_Vectorcall = (PyObject_VectorcallFn)LOOKUP_OPTIONAL_SYMBOL(pylib, "PyObject_Vectorcall");
+        fObject_VectorcallLookedUp = true;
+    }
+    if (fObject_Vectorcall)
+        return fObject_Vectorcall(callable, args, nargsf, kwnames);
+    const Py_ssize_t nargs = Py_ssize_t(nargsf & ~PY_VECTORCALL_ARGUMENTS_OFFSET);
+    PyObject *py_args = DPyTuple_New(nargs);
+    if (!py_args)
+        return nullptr;
+    for (Py_ssize_t i = 0; i < nargs; ++i)
+    {
+        Py_INCREF(args[i]);
+        DPyTuple_SetItem(py_args, i, args[i]);  // steals reference
+    }
+    PyObject *result = DPyObject_CallObject(callable, py_args);
+    Py_DECREF(py_args);
+    return result;
+}
+
 PyObject* DPyRun_SimpleString(const char *str)
 {
     if (fRun_SimpleString == 0)
@@ -742,6 +827,49 @@ PyObject* DPyUnicode_DecodeUTF16(const char *s, Py_ssize_t size, const char *err
     return fUnicode_DecodeUTF16(s, size, errors, byteorder);
 }
 
+PyObject* DPyUnicode_InternFromString(const char *u)
+{
+    if (fUnicode_InternFromString == 0)
+        fUnicode_InternFromString = (PyUnicode_InternFromStringFn)LOOKUP_SYMBOL(pylib, "PyUnicode_InternFromString");
+    return fUnicode_InternFromString(u);
+}
+
+int DPyWeakref_GetRef(PyObject *ref, PyObject **pobj)
+{
+    // PyWeakref_GetRef is exported from Python 3.13, which deprecates PyWeakref_GetObject. earlier versions
+    // get the borrowed object, which is None when the object is dead.
+    if (!fWeakref_GetRefLookedUp)
+    {
+        fWeakref_GetRef = (PyWeakref_GetRefFn)LOOKUP_OPTIONAL_SYMBOL(pylib, "PyWeakref_GetRef");
+        fWeakref_GetRefLookedUp = true;
+    }
+    if (fWeakref_GetRef)
+        return fWeakref_GetRef(ref, pobj);
+    if (fWeakref_GetObject == 0)
+        fWeakref_GetObject = (PyWeakref_GetObjectFn)LOOKUP_SYMBOL(pylib, "PyWeakref_GetObject");
+    PyObject *object = fWeakref_GetObject(ref);
+    if (!object)
+    {
+        *pobj = nullptr;
+        return -1;
+    }
+    if (object == DPy_NoneGet())
+    {
+        *pobj = nullptr;
+        return 0;
+    }
+    Py_INCREF(object);
+    *pobj = object;
+    return 1;
+}
+
+PyObject* DPyWeakref_NewRef(PyObject *ob, PyObject *callback)
+{
+    if (fWeakref_NewRef == 0)
+        fWeakref_NewRef = (PyWeakref_NewRefFn)LOOKUP_SYMBOL(pylib, "PyWeakref_NewRef");
+    return fWeakref_NewRef(ob, callback);
+}
+
 PyObject* DPyUnicode_FromString(const char *u)
 {
     if (fUnicode_FromString == 0)
@@ -3,13 +3,20 @@
 #define DECLARE_PY(x) D##x
 #define CALL_PY(x) D##x
 
+// defined by the headers of Python 3.8 and later.
+#if !defined(PY_VECTORCALL_ARGUMENTS_OFFSET)
+#define PY_VECTORCALL_ARGUMENTS_OFFSET ((size_t)1 << (8 * sizeof(size_t) - 1))
+#endif
+
 void DECLARE_PY(PyBuffer_Release)(Py_buffer *o);
 int DECLARE_PY(PyCallable_Check)(PyObject *o);
 void* DECLARE_PY(PyCapsule_GetPointer)(PyObject *capsule, const char *name);
 int DECLARE_PY(PyCapsule_IsValid)(PyObject *capsule, const char *name);
 PyObject* DECLARE_PY(PyCapsule_New)(void *pointer, const char *name, PyCapsule_Destructor destructor);
+PyObject* DECLARE_PY(PyDict_GetItem)(PyObject *p, PyObject *key);
 PyObject* DECLARE_PY(PyDict_GetItemString)(PyObject *p, const char *key);
 PyObject* DECLARE_PY(PyDict_New)();
+int DECLARE_PY(PyDict_Next)(PyObject *p, Py_ssize_t *ppos, PyObject **pkey, PyObject **pvalue);
 int DECLARE_PY(PyDict_SetItem)(PyObject *p, PyObject *key, PyObject *val);
 void DECLARE_PY(PyErr_Clear)();
 PyObject* DECLARE_PY(PyErr_Format)(PyObject *exception, const char *format, ...);
@@ -49,10 +56,12 @@ PyObject* DECLARE_PY(PyModule_GetDict)(PyObject *module);
 PyObject* DECLARE_PY(PyObject_CallObject)(PyObject *callable_object, PyObject *args);
 PyObject* DECLARE_PY(PyObject_GetAttr)(PyObject *o, PyObject *attr_name);
 PyObject* DECLARE_PY(PyObject_GetAttrString)(PyObject *o, const char *attr_name);
+PyObject* DECLARE_PY(PyObject_GenericGetDict)(PyObject *o, void *context);
 int DECLARE_PY(PyObject_GetBuffer)(PyObject *exporter, Py_buffer *view, int flags);
 int DECLARE_PY(PyObject_HasAttrString)(PyObject *o, const char *attr_name);
 int DECLARE_PY(PyObject_IsTrue)(PyObject *o);
 int DECLARE_PY(PyObject_SetAttr)(PyObject *o, PyObject *attr_name, PyObject *v);
+PyObject* DECLARE_PY(PyObject_Vectorcall)(PyObject *callable, PyObject *const *args, size_t nargsf, PyObject *kwnames);
 PyObject* DECLARE_PY(PyRun_SimpleString)(const char *str);
 PyObject* DECLARE_PY(PyRun_StringFlags)(const char *str, int start, PyObject *globals, PyObject *locals, PyCompilerFlags *flags);
 int DECLARE_PY(PySequence_Check)(PyObject *o);
@@ -67,6 +76,9 @@ int DECLARE_PY(PyType_IsSubtype)(PyTypeObject *a, PyTypeObject *b);
 char* DECLARE_PY(PyUnicode_AsUTF8)(PyObject *unicode);
 PyObject* DECLARE_PY(PyUnicode_DecodeUTF16)(const char *s, Py_ssize_t size, const char *errors, int *byteorder);
 PyObject* DECLARE_PY(PyUnicode_FromString)(const char *u);
+PyObject* DECLARE_PY(PyUnicode_InternFromString)(const char *u);
+int DECLARE_PY(PyWeakref_GetRef)(PyObject *ref, PyObject **pobj);
+PyObject* DECLARE_PY(PyWeakref_NewRef)(PyObject *ob, PyObject *callback);
 wchar_t *DECLARE_PY(PyUnicode_AsWideCharString)(PyObject *unicode, Py_ssize_t *size);
 void DECLARE_PY(PyMem_Free)(void *p);
 PyObject* DECLARE_PY(Py_CompileStringExFlags)(const char *str, const char *filename, int start, PyCompilerFlags *flags, int optimize);
@@ -78,6 +90,7 @@ void DECLARE_PY(Py_SetProgramName)(wchar_t *home);
 bool DECLARE_PY(PyBool_Check)(PyObject *o);
 bool DECLARE_PY(PyCapsule_CheckExact)(PyObject *o);
 bool DECLARE_PY(PyFloat_Check)(PyObject *o);
+bool DECLARE_PY(PyMethod_Check)(PyObject *o);
 bool DECLARE_PY(PyModule_Check)(PyObject *o);
 PyObject* DECLARE_PY(PyExc_GetAttributeError)();
 PyObject* DECLARE_PY(PyExc_GetImportError)();
@@ -34,6 +34,7 @@
 #include "PythonStubs.h"
 
 #include "Image.h"
+#include "ImageKernels.h"
 #include "FileSystem.h"
 
 #if OS_WINDOWS
@@ -532,6 +533,11 @@ void PythonSupport::deinitialize()
     // grab the GIL that was released after Py_Initialize.
     CALL_PY(PyEval_RestoreThread)(m_initial_state);
 
+    releaseCachedMethods(false);
+    for (auto const &method_name : m_method_names)
+        Py_DECREF(method_name.second);
+    m_method_names.clear();
+
     // finalize.
     CALL_PY(Py_Finalize)();
 }
@@ -755,6 +761,162 @@ PythonValueVariant PythonSupport::invokePyMethod(PyObjectPtr *object, const std:
     return PythonValueVariant();
 }
 
+PyObject *PythonSupport::callMethod(PyObject *object, const std::string &method, PyObject *const *args, size_t count)
+{
+    PyObject *&py_method = m_method_names[method];
+    if (!py_method)
+        py_method = CALL_PY(PyUnicode_InternFromString)(method.c_str());
+    if (!py_method)
+    {
+        m_method_names.erase(method);
+        printAndClearErrors();
+        return nullptr;
+    }
+
+    // the arguments are passed with a free slot in front so that vectorcall can prepend the bound object
+    // without copying them; slot 1 is the object itself when calling the function of a cached method.
+    PyObject *stack_args[8];
+    std::vector<PyObject *> heap_args;
+    PyObject **call_args = stack_args;
+    if (count + 2 > 8)
+    {
+        heap_args.resize(count + 2);
+        call_args = heap_args.data();
+    }
+    std::copy(args, args + count, call_args + 2);
+
+    const auto key = std::make_pair(object, py_method);
+    auto iter = m_cached_methods.find(key);
+    if (iter != m_cached_methods.end() && !isCachedMethodCurrent(iter->second, object, py_method))
+    {
+        Py_DECREF(iter->second.object_ref);
+        Py_DECREF(iter->second.function);
+        m_cached_methods.erase(iter);
+        iter = m_cached_methods.end();
+    }
+
+    if (iter == m_cached_methods.end())
+    {
+        PyObject *attribute = CALL_PY(PyObject_GetAttr)(object, py_method);
+        if (!attribute)
+        {
+            printAndClearErrors();
+            return nullptr;
+        }
+
+        // only methods bound to the object itself can be called through their function; other callables
+        // (and objects without weak reference support or a class version tag) are called as attributes each time.
+        // the lookup assigns the version tag of the class if it has none.
+        PyTypeObject *type = Py_TYPE(object);
+        const unsigned int type_version = type->tp_version_tag;
+        PyObject *object_ref = nullptr;
+        if (CALL_PY(PyMethod_Check)(attribute) && PyMethod_GET_SELF(attribute) == object && type_version != 0)
+        {
+            object_ref = CALL_PY(PyWeakref_NewRef)(object, nullptr);
+            if (!object_ref)
+                CALL_PY(PyErr_Clear)();
+        }
+
+        if (!object_ref)
+        {
+            PyObject *result = CALL_PY(PyObject_Vectorcall)(attribute, call_args + 2, count | PY_VECTORCALL_ARGUMENTS_OFFSET, nullptr);
+            Py_DECREF(attribute);
+            if (!result)
+                printAndClearErrors();
+            return result;
+        }
+
+        // sweep the entries of dead objects when the cache has doubled since the last sweep, so that the cost
+        // of sweeping is proportional to the number of entries added.
+        if (m_cached_methods.size() >= m_cached_methods_sweep_size)
+        {
+            releaseCachedMethods(true);
+            m_cached_methods_sweep_size = std::max(size_t(4096), m_cached_methods.size() * 2);
+        }
+
+        // objects without an instance dict cannot have the method assigned to them.
+        PyObject *dict = CALL_PY(PyObject_GenericGetDict)(object, nullptr);
+        if (!dict)
+            CALL_PY(PyErr_Clear)();
+        Py_XDECREF(dict);
+
+        PyObject *function = PyMethod_GET_FUNCTION(attribute);
+        Py_INCREF(function);
+        Py_DECREF(attribute);
+        iter = m_cached_methods.emplace(key, CachedMethod{object_ref, function, type, type_version, dict != nullptr}).first;
+    }
+
+    // hold the function in case the call forgets the methods of the object.
+    PyObject *function = iter->second.function;
+    Py_INCREF(function);
+    call_args[1] = object;
+    PyObject *result = CALL_PY(PyObject_Vectorcall)(function, call_args + 1, (count + 1) | PY_VECTORCALL_ARGUMENTS_OFFSET, nullptr);
+    Py_DECREF(function);
+    if (!result)
+        printAndClearErrors();
+    return result;
+}
+
+void PythonSupport::forgetMethods(PyObject *object)
+{
+    auto iter = m_cached_methods.lower_bound(std::make_pair(object, static_cast<PyObject *>(nullptr)));
+    while (iter != m_cached_methods.end() && iter->first.first == object)
+    {
+        Py_DECREF(iter->second.object_ref);
+        Py_DECREF(iter->second.function);
+        iter = m_cached_methods.erase(iter);
+    }
+}
+
+bool PythonSupport::isCachedMethodCurrent(const CachedMethod &cached_method, PyObject *object, PyObject *method)
+{
+    PyObject *referent = nullptr;
+    if (CALL_PY(PyWeakref_GetRef)(cached_method.object_ref, &referent) < 0)
+        CALL_PY(PyErr_Clear)();
+    Py_XDECREF(referent);  // the caller holds a reference to the object if it is the referent
+    if (referent != object)
+        return false;
+
+    PyTypeObject *type = Py_TYPE(object);
+    if (type != cached_method.type || type->tp_version_tag != cached_method.type_version)
+        return false;
+
+    if (cached_method.has_dict)
+    {
+        PyObject *dict = CALL_PY(PyObject_GenericGetDict)(object, nullptr);
+        if (!dict)
+        {
+            CALL_PY(PyErr_Clear)();
+            return false;
+        }
+        const bool assigned = CALL_PY(PyDict_GetItem)(dict, method) != nullptr;
+        Py_DECREF(dict);
+        if (assigned)
+            return false;
+    }
+
+    return true;
+}
+
+void PythonSupport::releaseCachedMethods(bool dead_only)
+{
+    for (auto iter = m_cached_methods.begin(); iter != m_cached_methods.end(); )
+    {
+        PyObject *referent = nullptr;
+        if (dead_only && CALL_PY(PyWeakref_GetRef)(iter->second.object_ref, &referent) < 0)
+            CALL_PY(PyErr_Clear)();
+        Py_XDECREF(referent);
+        if (!dead_only || referent != iter->first.first)
+        {
+            Py_DECREF(iter->second.object_ref);
+            Py_DECREF(iter->second.function);
+            iter = m_cached_methods.erase(iter);
+        }
+        else
+            ++iter;
+    }
+}
+
 
 PythonValueVariant PythonSupport::getAttribute(PyObjectPtr *object, const std::string &attribute)
 {
@@ -812,383 +974,59 @@ bool PythonSupport::setAttribute(PyObjectPtr *object, const std::string &attribu
     return result != -1;
 }
 
-void PythonSupport::scaledImageFromRGBA(PyObject *ndarray_py, unsigned int dest_width, unsigned int dest_height, ImageInterface *image)
+ImageKernels::ImageBuffer PythonSupport::pinArray(PyObject *ndarray_py)
 {
-    Py_buffer array;
-    if (CALL_PY(PyObject_GetBuffer)(ndarray_py, &array, PyBUF_ANY_CONTIGUOUS) >= 0)
-    {
-        long width = array.shape[1];
-        long height = array.shape[0];
-        if (dest_width < width * 0.75 || dest_height < height * 0.75)
-        {
-            image->create((int)dest_width, (int)dest_height, ImageFormat::Format_ARGB32);
-
-            int *a_buffer = new int[dest_width];
-            int *r_buffer = new int[dest_width];
-            int *g_buffer = new int[dest_width];
-            int *b_buffer = new int[dest_width];
-            long *x_index_buffer = new long[width];
-            long *y_index_buffer = new long[height];
+    ImageKernels::ImageBuffer image_buffer;
 
-            for (int row=0; row<height; ++row)
-                y_index_buffer[row] = floor(row / (float(height) / dest_height));
-
-            for (int col=0; col<width; ++col)
-                x_index_buffer[col] = floor(col / (float(width) / dest_width));
-
-            long *y_index_ptr = y_index_buffer;
-
-            long last_dst_row = -1;
-            long last_row_change = -1;
-            for (int row=0; row<height; ++row)
-            {
-                long dst_row = *y_index_ptr++;
-                if (dst_row != last_dst_row)
-                {
-                    if (dst_row > 0)
-                    {
-                        uint32_t *dst = (uint32_t *)image->scanLine(last_dst_row);
-                        int *a_ptr = a_buffer;
-                        int *r_ptr = r_buffer;
-                        int *g_ptr = g_buffer;
-                        int *b_ptr = b_buffer;
-                        int mm =  row - last_row_change;
-                        for (int dst_col=0; dst_col<dest_width; ++dst_col)
-                        {
-                            uint8_t a = *a_ptr++ / mm;
-                            uint8_t r = *r_ptr++ / mm;
-                            uint8_t g = *g_ptr++ / mm;
-                            uint8_t b = *b_ptr++ / mm;
-                            *dst++ = (a << 24) | (r << 16) | (g << 8) | b;
-                        }
-                    }
-
-                    last_dst_row = dst_row;
-                    last_row_change = row;
-
-                    memset(a_buffer, 0, dest_width * sizeof(int));
-                    memset(r_buffer, 0, dest_width * sizeof(int));
-                    memset(g_buffer, 0, dest_width * sizeof(int));
-                    memset(b_buffer, 0, dest_width * sizeof(int));
-                }
-
-                uint32_t *src = ((uint32_t *)array.buf) + row*width;
-                int *a_ptr = a_buffer;
-                int *r_ptr = r_buffer;
-                int *g_ptr = g_buffer;
-                int *b_ptr = b_buffer;
-                long *x_index_ptr = x_index_buffer;
-
-                long last_dst_col = -1;
-                long last_col_change = -1;
-                int a_sum = 0;
-                int r_sum = 0;
-                int g_sum = 0;
-                int b_sum = 0;
-                for (int col=0; col<width; ++col)
-                {
-                    long dst_col = *x_index_ptr++;
-                    if (dst_col != last_dst_col)
-                    {
-                        if (dst_col > 0)
-                        {
-                            int mm = col - last_col_change;
-                            *a_ptr++ += a_sum / mm;
-                            *r_ptr++ += r_sum / mm;
-                            *g_ptr++ += g_sum / mm;
-                            *b_ptr++ += b_sum / mm;
-                        }
-                        last_dst_col = dst_col;
-                        last_col_change = col;
-                        uint32_t argb = *src++;
-                        a_sum = argb >> 24;
-                        r_sum = (argb & 0x00FF0000) >> 16;
-                        g_sum = (argb & 0x0000FF00) >> 8;
-                        b_sum = argb & 0x000000FF;
-                    }
-                    else
-                    {
-                        uint32_t argb = *src++;
-                        a_sum += argb >> 24;
-                        r_sum += (argb & 0x00FF0000) >> 16;
-                        g_sum += (argb & 0x0000FF00) >> 8;
-                        b_sum += argb & 0x000000FF;
-                    }
-                }
-
-                int mm = width - last_col_change;
-                *a_ptr += a_sum / mm;
-                *r_ptr += r_sum / mm;
-                *g_ptr += g_sum / mm;
-                *b_ptr += b_sum / mm;
-            }
-
-            uint32_t *dst = (uint32_t *)image->scanLine(last_dst_row);
-            int *a_ptr = a_buffer;
-            int *r_ptr = r_buffer;
-            int *g_ptr = g_buffer;
-            int *b_ptr = b_buffer;
-            int mm =  height - last_row_change;
-            for (int dst_col=0; dst_col<dest_width; ++dst_col)
-            {
-                uint8_t a = *a_ptr++ / mm;
-                uint8_t r = *r_ptr++ / mm;
-                uint8_t g = *g_ptr++ / mm;
-                uint8_t b = *b_ptr++ / mm;
-                *dst++ = (a << 24) | (r << 16) | (g << 8) | b;
-            }
+    Py_buffer buffer;
+    if (CALL_PY(PyObject_GetBuffer)(ndarray_py, &buffer, PyBUF_ANY_CONTIGUOUS | PyBUF_FORMAT) < 0)
+    {
+        CALL_PY(PyErr_Clear)();
+        return image_buffer;
+    }
 
-            delete [] a_buffer;
-            delete [] r_buffer;
-            delete [] g_buffer;
-            delete [] b_buffer;
-            delete [] x_index_buffer;
-            delete [] y_index_buffer;
+    image_buffer.owner = bufferOwner(buffer);
 
-            CALL_PY(PyBuffer_Release)(&array);
+    const Py_buffer *view = static_cast<const Py_buffer *>(image_buffer.owner.get());
 
-            // qDebug() << width << "x" << height << " --> " << dest_width << "x" << dest_height;
-        }
-        else
-        {
-            image->create((int)width, (int)height, ImageFormat::Format_ARGB32);
-            for (int row=0; row<height; ++row)
-                memcpy(image->scanLine(row), ((uint32_t *)array.buf) + row*width, width*sizeof(uint32_t));
-            CALL_PY(PyBuffer_Release)(&array);
-        }
+    if (view->ndim >= 1 && view->shape)
+    {
+        image_buffer.data = view->buf;
+        image_buffer.source = view->obj;
+        image_buffer.height = view->ndim >= 2 ? view->shape[0] : 1;
+        image_buffer.width = view->ndim >= 2 ? view->shape[1] : view->shape[0];
+        image_buffer.item_size = view->itemsize;
+        image_buffer.length = view->len;
+        image_buffer.data_type = ImageKernels::dataTypeFromFormat(view->format, view->itemsize);
     }
+
+    return image_buffer;
 }
 
 void PythonSupport::imageFromRGBA(PyObject *ndarray_py, ImageInterface *image)
 {
-    Py_buffer array;
-    if (CALL_PY(PyObject_GetBuffer)(ndarray_py, &array, PyBUF_ANY_CONTIGUOUS) >= 0)
-    {
-        long width = array.shape[1];
-        long height = array.shape[0];
-        image->create((int)width, (int)height, ImageFormat::Format_ARGB32);
-        for (int row=0; row<height; ++row)
-            memcpy(image->scanLine(row), ((uint32_t *)array.buf) + row*width, width*sizeof(uint32_t));
-        CALL_PY(PyBuffer_Release)(&array);
-    }
+    ImageKernels::imageFromRGBA(pinArray(ndarray_py), image);
 }
 
-void PythonSupport::scaledImageFromArray(PyObject *ndarray_py, float width_, float height_, float context_scaling, float display_limit_low, float display_limit_high, PyObject *lookup_table_ndarray, ImageInterface *image)
+void PythonSupport::scaledImageFromRGBA(PyObject *ndarray_py, unsigned int width, unsigned int height, ImageInterface *image)
 {
-    Py_buffer array;
-    if (CALL_PY(PyObject_GetBuffer)(ndarray_py, &array, PyBUF_ANY_CONTIGUOUS) >= 0)
-    {
-        long width = array.shape[1];
-        long height = array.shape[0];
-        float m = display_limit_high != display_limit_low ? 255.0 / (display_limit_high - display_limit_low) : 1;
-        std::vector<unsigned int> colorTable;
-        if (lookup_table_ndarray != NULL)
-        {
-            Py_buffer view;
-            if (CALL_PY(PyObject_GetBuffer)(lookup_table_ndarray, &view, PyBUF_ANY_CONTIGUOUS) >= 0)
-            {
-                uint32_t *lookup_table = ((uint32_t *)view.buf);
-                for (int i=0; i<256; ++i)
-                    colorTable.push_back(lookup_table[i]);
-                CALL_PY(PyBuffer_Release)(&view);
-            }
-        }
-        if (colorTable.size() == 0)
-            for (int i=0; i<256; ++i)
-                colorTable.push_back(0xFF << 24 | i << 16 | i << 8 | i);
-
-        const long dest_width = width_ * context_scaling;
-        const long dest_height = height_ * context_scaling;
-
-        if ((width_ * context_scaling < width * 0.75 || height_ * context_scaling < height * 0.75) && (dest_width > 0 && dest_height > 0))
-        {
-            image->create((int)dest_width, (int)dest_height, ImageFormat::Format_Indexed8);
-
-            float *line_buffer = new float[dest_width];
-            long *x_index_buffer = new long[width];
-            long *y_index_buffer = new long[height];
-
-            for (int row=0; row<height; ++row)
-                y_index_buffer[row] = floor(row / (float(height) / dest_height));
-
-            for (int col=0; col<width; ++col)
-                x_index_buffer[col] = floor(col / (float(width) / dest_width));
-
-            long *y_index_ptr = y_index_buffer;
-
-            long last_dst_row = -1;
-            long last_row_change = -1;
-            for (int row=0; row<height; ++row)
-            {
-                long dst_row = *y_index_ptr++;
-                if (dst_row != last_dst_row)
-                {
-                    if (dst_row > 0)
-                    {
-                        uint8_t *dst = (uint8_t *)image->scanLine(last_dst_row);
-                        float *line_ptr = line_buffer;
-                        float mm =  1.0 / (row - last_row_change);
-                        for (int dst_col=0; dst_col<dest_width; ++dst_col)
-                        {
-                            float v = *line_ptr++ * mm;
-                            if (v < display_limit_low)
-                                *dst++ = 0x00;
-                            else if (v > display_limit_high)
-                                *dst++ = 0xFF;
-                            else
-                                *dst++ = (unsigned char)((v - display_limit_low) * m);
-                        }
-                    }
-
-                    last_dst_row = dst_row;
-                    last_row_change = row;
-
-                    memset(line_buffer, 0, dest_width * sizeof(float));
-                }
-
-                float *src = ((float *)array.buf) + row*width;
-                float *line_ptr = line_buffer;
-                long *x_index_ptr = x_index_buffer;
-
-                long last_dst_col = -1;
-                long last_col_change = -1;
-                float sum = 0.0;
-                for (int col=0; col<width; ++col)
-                {
-                    long dst_col = *x_index_ptr++;
-                    if (dst_col != last_dst_col)
-                    {
-                        if (dst_col > 0)
-                            *line_ptr++ += sum / (col - last_col_change);
-                        last_dst_col = dst_col;
-                        last_col_change = col;
-                        sum = *src++;
-                    }
-                    else
-                    {
-                        sum += *src++;
-                    }
-                }
-
-                *line_ptr += sum / (width - last_col_change);
-            }
-
-            uint8_t *dst = (uint8_t *)image->scanLine(last_dst_row);
-            float *line_ptr = line_buffer;
-            float mm =  1.0 / (height - last_row_change);
-            for (int dst_col=0; dst_col<dest_width; ++dst_col)
-            {
-                float v = *line_ptr++ * mm;
-                if (v < display_limit_low)
-                    *dst++ = 0x00;
-                else if (v > display_limit_high)
-                    *dst++ = 0xFF;
-                else
-                    *dst++ = (unsigned char)((v - display_limit_low) * m);
-            }
-
-            delete [] line_buffer;
-            delete [] x_index_buffer;
-            delete [] y_index_buffer;
-
-            image->setColorTable(colorTable);
-            CALL_PY(PyBuffer_Release)(&array);
+    ImageKernels::scaledImageFromRGBA(pinArray(ndarray_py), width, height, image);
+}
 
-            // qDebug() << width << "x" << height << " --> " << dest_width << "x" << dest_height;
-        }
-        else
-        {
-            image->create((int)width, (int)height, ImageFormat::Format_Indexed8);
-            for (int row=0; row<height; ++row)
-            {
-                float *src = ((float *)array.buf) + row*width;
-                uint8_t *dst = (uint8_t *)image->scanLine(row);
-                for (int col=0; col<width; ++col)
-                {
-                    float v = *src++;
-                    if (v < display_limit_low)
-                        *dst++ = 0x00;
-                    else if (v > display_limit_high)
-                        *dst++ = 0xFF;
-                    else
-                        *dst++ = (unsigned char)((v - display_limit_low) * m);
-                }
-            }
-            image->setColorTable(colorTable);
-            CALL_PY(PyBuffer_Release)(&array);
-        }
-    }
+void PythonSupport::scaledImageFromArray(PyObject *ndarray_py, float width, float height, float context_scaling, float display_limit_low, float display_limit_high, PyObject *lookup_table_ndarray, ImageInterface *image)
+{
+    ImageKernels::ImageBuffer lookup_table;
+    if (lookup_table_ndarray != NULL)
+        lookup_table = pinArray(lookup_table_ndarray);
+    ImageKernels::scaledImageFromArrayARGB32(pinArray(ndarray_py), width, height, context_scaling, display_limit_low, display_limit_high, lookup_table.isValid() ? &lookup_table : nullptr, image);
 }
 
 void PythonSupport::imageFromArray(PyObject *ndarray_py, float display_limit_low, float display_limit_high, PyObject *lookup_table_ndarray, ImageInterface *image)
 {
-    Py_buffer array;
-    if (CALL_PY(PyObject_GetBuffer)(ndarray_py, &array, PyBUF_ANY_CONTIGUOUS) >= 0)
-    {
-        long width = array.shape[1];
-        long height = array.shape[0];
-        float m = display_limit_high != display_limit_low ? 255.0 / (display_limit_high - display_limit_low) : 1;
-        std::vector<unsigned int> colorTable;
-        if (lookup_table_ndarray != NULL)
-        {
-            Py_buffer view;
-            if (CALL_PY(PyObject_GetBuffer)(lookup_table_ndarray, &view, PyBUF_ANY_CONTIGUOUS) >= 0)
-            {
-                uint32_t *lookup_table = ((uint32_t *)view.buf);
-                for (int i=0; i<256; ++i)
-                    colorTable.push_back(lookup_table[i]);
-                CALL_PY(PyBuffer_Release)(&view);
-            }
-        }
-        if (colorTable.size() == 0)
-            for (int i=0; i<256; ++i)
-                colorTable.push_back(0xFF << 24 | i << 16 | i << 8 | i);
-        if (false)
-        {
-            const unsigned int *colorTableP = static_cast<const unsigned int *>(colorTable.data());
-            image->create((int)width, (int)height, ImageFormat::Format_ARGB32_Premultiplied);
-            for (int row=0; row<height; ++row)
-            {
-                float *src = ((float *)array.buf) + row*width;
-                uint32_t *dst = (uint32_t *)image->scanLine(row);
-                for (int col=0; col<width; ++col)
-                {
-                    float v = *src++;
-                    if (v < display_limit_low)
-                        *dst++ = colorTableP[0];
-                    else if (v > display_limit_high)
-                        *dst++ = colorTableP[255];
-                    else
-                    {
-                        unsigned char vv = (unsigned char)((v - display_limit_low) * m);
-                        *dst++ = colorTableP[vv];
-                    }
-                }
-            }
-            CALL_PY(PyBuffer_Release)(&array);
-        }
-        else
-        {
-            image->create((int)width, (int)height, ImageFormat::Format_Indexed8);
-            for (int row=0; row<height; ++row)
-            {
-                float *src = ((float *)array.buf) + row*width;
-                uint8_t *dst = (uint8_t *)image->scanLine(row);
-                for (int col=0; col<width; ++col)
-                {
-                    float v = *src++;
-                    if (v < display_limit_low)
-                        *dst++ = 0x00;
-                    else if (v > display_limit_high)
-                        *dst++ = 0xFF;
-                    else
-                        *dst++ = (unsigned char)((v - display_limit_low) * m);
-                }
-            }
-            image->setColorTable(colorTable);
-            CALL_PY(PyBuffer_Release)(&array);
-        }
-    }
+    ImageKernels::ImageBuffer lookup_table;
+    if (lookup_table_ndarray != NULL)
+        lookup_table = pinArray(lookup_table_ndarray);
+    ImageKernels::imageFromArray(pinArray(ndarray_py), display_limit_low, display_limit_high, lookup_table.isValid() ? &lookup_table : nullptr, image);
 }
 
 void PythonSupport::arrayFromImage(const ImageInterface &image, PyObject *target)
@@ -1230,6 +1068,24 @@ void PythonSupport::bufferRelease(Py_buffer *buffer)
     CALL_PY(PyBuffer_Release)(buffer);
 }
 
+std::shared_ptr<void> PythonSupport::bufferOwner(const Py_buffer &buffer)
+{
+    // the view holds a reference to the exporting object. release it, with the GIL, when the
+    // last copy of the owner goes away, which may be on any thread.
+    Py_buffer *owned_view = new Py_buffer(buffer);
+    // simple exporters (PyBuffer_FillInfo) point the shape and strides into the view itself.
+    if (buffer.shape == &buffer.len)
+        owned_view->shape = &owned_view->len;
+    if (buffer.strides == &buffer.itemsize)
+        owned_view->strides = &owned_view->itemsize;
+    return std::shared_ptr<void>(owned_view, [](void *p) {
+        Py_buffer *view = static_cast<Py_buffer *>(p);
+        Python_ThreadBlock thread_block;
+        CALL_PY(PyBuffer_Release)(view);
+        delete view;
+    });
+}
+
 void PythonSupport::setErrorString(const std::string &error_string)
 {
     CALL_PY(PyErr_SetString)(module_exception, error_string.c_str());
@@ -133,6 +133,8 @@ public:
 
 class ImageInterface;
 
+namespace ImageKernels { struct ImageBuffer; }
+
 typedef PyObject *CreateAndAddModuleFn();
 
 class FileSystem;
@@ -156,6 +158,8 @@ public:
     void initialize(const std::string &python_home, const std::list<std::string> &python_paths, const std::string &python_library);
     void deinitialize();
     void addResourcePath(const std::string &resources_path);
+    // pin the buffer of an array so that it can be read without the GIL. must be called with the GIL.
+    ImageKernels::ImageBuffer pinArray(PyObject *ndarray_py);
     void imageFromRGBA(PyObject *ndarray_py, ImageInterface *image);
     void scaledImageFromRGBA(PyObject *ndarray_py, unsigned int width, unsigned int height, ImageInterface *image);
     void imageFromArray(PyObject *ndarray_py, float display_limit_low, float display_limit_high, PyObject *lookup_table, ImageInterface *image);
@@ -163,7 +167,16 @@ public:
     void arrayFromImage(const ImageInterface &image, PyObject *target);
     void shapeFromImage(PyObject *image, int &width, int &height);
     void bufferRelease(Py_buffer *buffer);
+    // take over a buffer obtained with the GIL; it is released (with the GIL) when the last copy of the owner goes away.
+    std::shared_ptr<void> bufferOwner(const Py_buffer &buffer);
     PythonValueVariant invokePyMethod(PyObjectPtr *object, const std::string &method, const std::list<PythonValueVariant> &args);
+    // call the method of the object with the (borrowed) arguments. returns a new reference, or null if the call
+    // failed, in which case the error is printed and cleared. bound methods are resolved once per object and
+    // method name and their functions called directly afterwards, until the class of the object or one of its
+    // bases is modified or the method is assigned to the object. must be called with the GIL.
+    PyObject *callMethod(PyObject *object, const std::string &method, PyObject *const *args, size_t count);
+    // forget the methods resolved for the object. must be called with the GIL.
+    void forgetMethods(PyObject *object);
     bool setAttribute(PyObjectPtr *object, const std::string &attribute, const PythonValueVariant &value);
     PythonValueVariant getAttribute(PyObjectPtr *object, const std::string &attribute);
     void setErrorString(const std::string &error_string);
@@ -209,6 +222,26 @@ private:
 
     // exceptions
     PyObject *module_exception;
+
+    // the function of a bound method and a weak reference to the object it was bound to. the object is alive
+    // (and the key is not a reused address) as long as the weak reference resolves to it. the class and its
+    // version tag, which changes when the class or a base is modified, detect methods rebound on the class.
+    struct CachedMethod
+    {
+        PyObject *object_ref;
+        PyObject *function;
+        PyTypeObject *type;
+        unsigned int type_version;
+        bool has_dict;  // whether to check the instance dict for a method assigned to the object
+    };
+
+    // resolved methods keyed by object and interned method name, and the interned method names. used with the GIL.
+    std::map<std::pair<PyObject *, PyObject *>, CachedMethod> m_cached_methods;
+    std::map<std::string, PyObject *> m_method_names;
+    size_t m_cached_methods_sweep_size = 4096;
+
+    bool isCachedMethodCurrent(const CachedMethod &cached_method, PyObject *object, PyObject *method);
+    void releaseCachedMethods(bool dead_only);
 };
 
 #endif // PYTHON_SUPPORT_H
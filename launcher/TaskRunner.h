@@ -0,0 +1,15 @@
+#ifndef TASKRUNNER_H
+#define TASKRUNNER_H
+
+#include <functional>
+
+class TaskRunner
+{
+public:
+    virtual ~TaskRunner() { }
+    // call fn(index) for each index in [0, count) using at most thread_count threads, including the
+    // calling thread. returns once every call has completed.
+    virtual void run(int count, int thread_count, const std::function<void(int)> &fn) = 0;
+};
+
+#endif
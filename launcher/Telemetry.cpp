@@ -0,0 +1,210 @@
+/*
+ Copyright (c) 2012-2024 Bruker, Inc.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+
+#include "Telemetry.h"
+
+namespace
+{
+    QMutex registry_mutex;
+    QMap<QString, Telemetry::HistogramSharedPtr> registry;
+
+    // index of the highest set bit of a positive value.
+    int highestBit(uint64_t value)
+    {
+        int bit = 0;
+        while (value >>= 1)
+            bit += 1;
+        return bit;
+    }
+}
+
+int64_t Telemetry::currentTimeNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t Telemetry::HistogramSnapshot::percentile(double percentile) const
+{
+    if (count <= 0)
+        return 0;
+
+    // the rank of the value, then the midpoint of the bucket holding it, within the recorded range.
+    const int64_t rank = std::max(int64_t(1), int64_t(percentile / 100.0 * count + 0.5));
+    int64_t cumulative = 0;
+    for (size_t index = 0; index < buckets.size(); ++index)
+    {
+        cumulative += buckets[index];
+        if (cumulative >= rank)
+        {
+            const int64_t lower = Histogram::bucketLowerBound(int(index));
+            const int64_t upper = Histogram::bucketUpperBound(int(index));
+            return std::min(maximum, std::max(minimum, lower + (upper - lower) / 2));
+        }
+    }
+    return maximum;
+}
+
+Telemetry::Histogram::Histogram()
+    : m_count(0)
+    , m_sum(0)
+    , m_minimum(std::numeric_limits<int64_t>::max())
+    , m_maximum(std::numeric_limits<int64_t>::min())
+    , m_last_mark_ns(0)
+{
+    for (auto &bucket : m_buckets)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+int Telemetry::Histogram::bucketIndex(int64_t value)
+{
+    if (value < SubBucketCount)
+        return value > 0 ? int(value) : 0;
+    const int exponent = std::min(highestBit(uint64_t(value)), MaximumExponent + 1);
+    if (exponent > MaximumExponent)
+        return BucketCount - 1;
+    const int sub_bucket = int((uint64_t(value) >> (exponent - SubBucketBits)) & (SubBucketCount - 1));
+    return (exponent - SubBucketBits + 1) * SubBucketCount + sub_bucket;
+}
+
+int64_t Telemetry::Histogram::bucketLowerBound(int index)
+{
+    if (index < SubBucketCount)
+        return index;
+    const int exponent = index / SubBucketCount + SubBucketBits - 1;
+    const int sub_bucket = index % SubBucketCount;
+    return int64_t(SubBucketCount + sub_bucket) << (exponent - SubBucketBits);
+}
+
+int64_t Telemetry::Histogram::bucketUpperBound(int index)
+{
+    if (index < SubBucketCount)
+        return index + 1;
+    const int exponent = index / SubBucketCount + SubBucketBits - 1;
+    return bucketLowerBound(index) + (int64_t(1) << (exponent - SubBucketBits));
+}
+
+void Telemetry::Histogram::record(int64_t value)
+{
+    value = std::max(value, int64_t(0));
+
+    m_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+
+    int64_t minimum = m_minimum.load(std::memory_order_relaxed);
+    while (value < minimum && !m_minimum.compare_exchange_weak(minimum, value, std::memory_order_relaxed))
+        ;
+    int64_t maximum = m_maximum.load(std::memory_order_relaxed);
+    while (value > maximum && !m_maximum.compare_exchange_weak(maximum, value, std::memory_order_relaxed))
+        ;
+}
+
+void Telemetry::Histogram::mark(int64_t time_ns)
+{
+    const int64_t last_mark_ns = m_last_mark_ns.exchange(time_ns, std::memory_order_relaxed);
+    if (last_mark_ns != 0)
+        record(time_ns - last_mark_ns);
+}
+
+Telemetry::HistogramSnapshot Telemetry::Histogram::snapshot() const
+{
+    HistogramSnapshot snapshot;
+    snapshot.buckets.resize(BucketCount);
+    for (int index = 0; index < BucketCount; ++index)
+    {
+        snapshot.buckets[index] = m_buckets[index].load(std::memory_order_relaxed);
+        snapshot.count += snapshot.buckets[index];
+    }
+    snapshot.sum = m_sum.load(std::memory_order_relaxed);
+    snapshot.minimum = snapshot.count > 0 ? m_minimum.load(std::memory_order_relaxed) : 0;
+    snapshot.maximum = snapshot.count > 0 ? m_maximum.load(std::memory_order_relaxed) : 0;
+    return snapshot;
+}
+
+void Telemetry::Histogram::reset()
+{
+    for (auto &bucket : m_buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_minimum.store(std::numeric_limits<int64_t>::max(), std::memory_order_relaxed);
+    m_maximum.store(std::numeric_limits<int64_t>::min(), std::memory_order_relaxed);
+    m_last_mark_ns.store(0, std::memory_order_relaxed);
+}
+
+Telemetry::HistogramSharedPtr Telemetry::histogram(const QString &name)
+{
+    QMutexLocker locker(&registry_mutex);
+
+    HistogramSharedPtr &histogram = registry[name];
+    if (!histogram)
+        histogram = std::make_shared<Histogram>();
+    return histogram;
+}
+
+void Telemetry::removeHistograms(const QString &prefix)
+{
+    QMutexLocker locker(&registry_mutex);
+
+    for (auto iter = registry.begin(); iter != registry.end(); )
+    {
+        if (iter.key().startsWith(prefix))
+            iter = registry.erase(iter);
+        else
+            ++iter;
+    }
+}
+
+QList<Telemetry::HistogramSnapshot> Telemetry::snapshots()
+{
+    QMap<QString, HistogramSharedPtr> histograms;
+
+    {
+        QMutexLocker locker(&registry_mutex);
+        histograms = registry;
+    }
+
+    QList<HistogramSnapshot> snapshots;
+    for (auto iter = histograms.constBegin(); iter != histograms.constEnd(); ++iter)
+    {
+        HistogramSnapshot snapshot = iter.value()->snapshot();
+        snapshot.name = iter.key();
+        snapshots.append(snapshot);
+    }
+    return snapshots;
+}
+
+void Telemetry::reset()
+{
+    QMutexLocker locker(&registry_mutex);
+
+    for (auto const &histogram : registry)
+        histogram->reset();
+}
+
+QStringList Telemetry::summary()
+{
+    QStringList lines;
+    for (auto const &snapshot : snapshots())
+    {
+        if (snapshot.count == 0)
+            continue;
+        lines.append(QString("%1 count %2 mean %3 p50 %4 p90 %5 p99 %6 max %7 ms")
+                     .arg(snapshot.name)
+                     .arg(snapshot.count)
+                     .arg(snapshot.mean() / 1.0E6, 0, 'f', 3)
+                     .arg(snapshot.percentile(50) / 1.0E6, 0, 'f', 3)
+                     .arg(snapshot.percentile(90) / 1.0E6, 0, 'f', 3)
+                     .arg(snapshot.percentile(99) / 1.0E6, 0, 'f', 3)
+                     .arg(snapshot.maximum / 1.0E6, 0, 'f', 3));
+    }
+    return lines;
+}
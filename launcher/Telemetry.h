@@ -0,0 +1,101 @@
+/*
+ Copyright (c) 2012-2024 Bruker, Inc.
+*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+/*
+ Telemetry for the launcher: named histograms of durations in nanoseconds, such as the render time,
+ queue wait, paint time and latency of canvas sections.
+
+ The histograms have log-linear buckets: values below 8 have their own bucket, and each power of
+ two above that is split into 8 linear buckets, so percentiles are accurate to within 1/16 of the
+ value. Recording is lock-free and may be done from any thread. Histograms are looked up by name in
+ a registry; the lookup takes a lock, so frequent recorders should keep the histogram.
+ */
+
+namespace Telemetry
+{
+    // the time of a steady clock in nanoseconds.
+    int64_t currentTimeNs();
+
+    struct HistogramSnapshot
+    {
+        QString name;
+        int64_t count = 0;
+        int64_t sum = 0;
+        int64_t minimum = 0;
+        int64_t maximum = 0;
+        std::vector<int64_t> buckets;
+
+        double mean() const { return count > 0 ? double(sum) / count : 0.0; }
+
+        // an estimate of the value below which the percentile (0-100) of the values fall.
+        int64_t percentile(double percentile) const;
+    };
+
+    class Histogram
+    {
+    public:
+        static const int SubBucketBits = 3;
+        static const int SubBucketCount = 1 << SubBucketBits;
+        static const int MaximumExponent = 47;  // values of 2^48 ns (3 days) and up share the last bucket
+        static const int BucketCount = (MaximumExponent - SubBucketBits + 2) * SubBucketCount;
+
+        Histogram();
+
+        void record(int64_t value);
+
+        // record the time since the previous mark, if any.
+        void mark(int64_t time_ns);
+
+        int64_t count() const { return m_count.load(std::memory_order_relaxed); }
+
+        // the values recorded while taking the snapshot may be partially included.
+        HistogramSnapshot snapshot() const;
+
+        void reset();
+
+        static int bucketIndex(int64_t value);
+        static int64_t bucketLowerBound(int index);
+        static int64_t bucketUpperBound(int index);
+
+    private:
+        std::atomic<int64_t> m_buckets[BucketCount];
+        std::atomic<int64_t> m_count;
+        std::atomic<int64_t> m_sum;
+        std::atomic<int64_t> m_minimum;
+        std::atomic<int64_t> m_maximum;
+        std::atomic<int64_t> m_last_mark_ns;
+    };
+
+    typedef std::shared_ptr<Histogram> HistogramSharedPtr;
+
+    // the histogram with the name, created if needed.
+    HistogramSharedPtr histogram(const QString &name);
+
+    // remove the histograms whose names start with the prefix. existing references remain valid.
+    void removeHistograms(const QString &prefix);
+
+    // snapshots of all histograms, sorted by name.
+    QList<HistogramSnapshot> snapshots();
+
+    // clear the values of all histograms.
+    void reset();
+
+    // a summary line per histogram, in milliseconds.
+    QStringList summary();
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ Copyright (c) 2012-2024 Bruker, Inc.
+*/
+
+/*
+ Replay a canvas trace (see CanvasTrace.h) through PaintBinaryCommands and report the frame times,
+ the time per drawing command, and the number of memory allocations per frame.
+
+ Usage: CanvasReplayBenchmark trace_file [iterations]
+
+ The offscreen platform is used unless QT_QPA_PLATFORM is set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <vector>
+
+#include <QtCore/QElapsedTimer>
+#include <QtGui/QGuiApplication>
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+
+#include "CanvasTrace.h"
+#include "DocumentWindow.h"
+
+static std::atomic<qint64> allocation_count(0);
+
+void *operator new(size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+static double Percentile(const std::vector<qint64> &sorted_values, double percentile)
+{
+    if (sorted_values.empty())
+        return 0.0;
+    size_t index = std::min(sorted_values.size() - 1, size_t(percentile / 100.0 * sorted_values.size()));
+    return sorted_values[index] / 1.0E6;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: CanvasReplayBenchmark trace_file [iterations]\n");
+        return 1;
+    }
+
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication app(argc, argv);
+
+    const QString file_path = QString::fromLocal8Bit(argv[1]);
+    const int iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+    std::vector<CanvasTraceFrame> frames;
+    {
+        CanvasTraceReader reader;
+        if (!reader.open(file_path))
+        {
+            printf("unable to read trace %s\n", qPrintable(file_path));
+            return 1;
+        }
+        CanvasTraceFrame frame;
+        while (reader.read(frame))
+            frames.push_back(frame);
+    }
+
+    if (frames.empty())
+    {
+        printf("no frames in trace %s\n", qPrintable(file_path));
+        return 1;
+    }
+
+    CommandProfile profile;
+    std::vector<qint64> frame_times_ns;
+    qint64 allocations = 0;
+
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        for (const auto &frame : frames)
+        {
+            if (!frame.commands || frame.commands->empty() || frame.rect.isEmpty())
+                continue;
+
+            // render the way the canvas render task does.
+            const qint64 allocations_start = allocation_count.load(std::memory_order_relaxed);
+            QElapsedTimer timer;
+            timer.start();
+
+            QImage image(QSize(frame.rect.width() * frame.device_pixel_ratio, frame.rect.height() * frame.device_pixel_ratio), QImage::Format_ARGB32_Premultiplied);
+            image.fill(QColor(0,0,0,0));
+            QPainter painter(&image);
+            painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing);
+            painter.scale(frame.device_pixel_ratio, frame.device_pixel_ratio);
+            PaintBinaryCommands(&painter, frame.commands, frame.image_buffers, RenderedTimeStamps(), frame.display_scaling, frame.section_id, frame.device_pixel_ratio, &profile);
+            painter.end();
+
+            frame_times_ns.push_back(timer.nsecsElapsed());
+            allocations += allocation_count.load(std::memory_order_relaxed) - allocations_start;
+        }
+    }
+
+    std::sort(frame_times_ns.begin(), frame_times_ns.end());
+
+    const size_t frame_count = frame_times_ns.size();
+
+    printf("%zu frames (%zu per iteration, %d iterations)\n", frame_count, frames.size(), iterations);
+    printf("frame ms: p50 %.3f p90 %.3f p99 %.3f max %.3f\n", Percentile(frame_times_ns, 50), Percentile(frame_times_ns, 90), Percentile(frame_times_ns, 99), Percentile(frame_times_ns, 100));
+    printf("allocations per frame: %.1f\n", frame_count > 0 ? double(allocations) / frame_count : 0.0);
+
+    std::vector<std::pair<quint32, CommandTiming>> timings(profile.constKeyValueBegin(), profile.constKeyValueEnd());
+    std::sort(timings.begin(), timings.end(), [](const auto &a, const auto &b) { return a.second.elapsed_ns > b.second.elapsed_ns; });
+
+    printf("%-6s %12s %12s %12s\n", "cmd", "count", "total ms", "mean us");
+    for (const auto &timing : timings)
+    {
+        const CommandTiming &t = timing.second;
+        printf("%-6s %12lld %12.3f %12.3f\n", qPrintable(CommandName(timing.first)), (long long)t.count, t.elapsed_ns / 1.0E6, t.count > 0 ? t.elapsed_ns / 1.0E3 / t.count : 0.0);
+    }
+
+    return 0;
+}
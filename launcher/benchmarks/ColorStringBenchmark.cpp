@@ -0,0 +1,89 @@
+/*
+ Copyright (c) 2012-2024 Bruker, Inc.
+*/
+
+/*
+ Compare ParseColorString with the regular expression implementation it replaced.
+
+ Usage: ColorStringBenchmark [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QRegularExpression>
+#include <QtCore/QStringList>
+#include <QtGui/QColor>
+
+#include "DocumentWindow.h"
+
+static QColor ParseColorStringRegularExpression(const QString &color_string)
+{
+    QColor color;
+    QRegularExpression re1("^rgba\\((\\d+),\\s*(\\d+),\\s*(\\d+),\\s*(\\d+\\.\\d+)\\)$");
+    QRegularExpression re2("^rgb\\((\\d+),\\s*(\\d+),\\s*(\\d+)\\)$");
+    QRegularExpressionMatch match1 = re1.match(color_string);
+    QRegularExpressionMatch match2 = re2.match(color_string);
+    if (match1.hasMatch())
+        color = QColor(match1.captured(1).toInt(), match1.captured(2).toInt(), match1.captured(3).toInt(), match1.captured(4).toFloat() * 255);
+    else if (match2.hasMatch())
+        color = QColor(match2.captured(1).toInt(), match2.captured(2).toInt(), match2.captured(3).toInt());
+    else
+        color = QColor(color_string);
+    return color;
+}
+
+template <typename F>
+static double TimeParse(const QStringList &color_strings, int iterations, F parse)
+{
+    QElapsedTimer timer;
+    unsigned int checksum = 0;
+    timer.start();
+    for (int i = 0; i < iterations; ++i)
+    {
+        for (const auto &color_string : color_strings)
+            checksum += parse(color_string).rgba();
+    }
+    qint64 elapsed_ns = timer.nsecsElapsed();
+    if (checksum == 1)  // keep the results alive
+        printf(" ");
+    return double(elapsed_ns) / (double(iterations) * color_strings.size());
+}
+
+int main(int argc, char **argv)
+{
+    const int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+
+    const QStringList color_strings = {
+        "rgba(255, 0, 0, 0.5)",
+        "rgba(12,34,56,1.0)",
+        "rgb(255, 128, 0)",
+        "rgb(0,0,0)",
+        "#F80",
+        "#ff8800",
+        "red",
+        "transparent",
+        "lightgoldenrodyellow",
+    };
+
+    int mismatches = 0;
+    for (const auto &color_string : color_strings)
+    {
+        QColor expected = ParseColorStringRegularExpression(color_string);
+        QColor actual = ParseColorString(color_string);
+        if (expected != actual)
+        {
+            printf("mismatch %s: %s %s\n", qPrintable(color_string), qPrintable(expected.name(QColor::HexArgb)), qPrintable(actual.name(QColor::HexArgb)));
+            mismatches += 1;
+        }
+    }
+
+    double regular_expression_ns = TimeParse(color_strings, iterations, ParseColorStringRegularExpression);
+    double parser_ns = TimeParse(color_strings, iterations, ParseColorString);
+
+    printf("regular expression %8.1f ns/color\n", regular_expression_ns);
+    printf("parser             %8.1f ns/color (%.1fx)\n", parser_ns, regular_expression_ns / parser_ns);
+
+    return mismatches == 0 ? 0 : 1;
+}
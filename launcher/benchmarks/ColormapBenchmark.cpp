@@ -0,0 +1,109 @@
+/*
+ Copyright (c) 2012-2024 Bruker, Inc.
+*/
+
+/*
+ Compare colormapping an array to an indexed image, which is converted to premultiplied ARGB32 when it is
+ drawn, against writing premultiplied ARGB32 through the lookup table directly, with 256 and 4096 entry
+ lookup tables. Each path is timed for the conversion alone and for the conversion and drawing together.
+
+ Usage: ColormapBenchmark [size] [iterations]
+
+ The offscreen platform is used unless QT_QPA_PLATFORM is set.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include <QtCore/QElapsedTimer>
+#include <QtGui/QGuiApplication>
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+
+#include "Application.h"
+#include "ImageKernels.h"
+
+struct Timing
+{
+    double convert_ms = 0.0;
+    double draw_ms = 0.0;
+};
+
+static Timing TimeColormap(const ImageKernels::ImageBuffer &array, const ImageKernels::ImageBuffer &lookup_table, bool direct, int iterations)
+{
+    QImage target(int(array.width), int(array.height), QImage::Format_ARGB32_Premultiplied);
+    Timing timing;
+    QElapsedTimer timer;
+    for (int i = 0; i < iterations; ++i)
+    {
+        QImageInterface image;
+        timer.start();
+        if (direct)
+            ImageKernels::scaledImageFromArrayARGB32(array, array.width, array.height, 1.0, 0.0, 1000.0, &lookup_table, &image);
+        else
+            ImageKernels::scaledImageFromArray(array, array.width, array.height, 1.0, 0.0, 1000.0, &lookup_table, &image);
+        timing.convert_ms += timer.nsecsElapsed() / 1.0E6;
+        QPainter painter(&target);
+        painter.drawImage(QPointF(), image.image);
+        painter.end();
+        timing.draw_ms += timer.nsecsElapsed() / 1.0E6;
+    }
+    timing.convert_ms /= iterations;
+    timing.draw_ms /= iterations;
+    return timing;
+}
+
+int main(int argc, char **argv)
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication app(argc, argv);
+
+    const int size = argc > 1 ? atoi(argv[1]) : 2048;
+    const int iterations = argc > 2 ? atoi(argv[2]) : 20;
+
+    std::vector<float> values(size_t(size) * size);
+    for (int row = 0; row < size; ++row)
+        for (int column = 0; column < size; ++column)
+            values[size_t(row) * size + column] = 500.0f + 500.0f * sinf(row * 0.01f) * cosf(column * 0.013f);
+
+    ImageKernels::ImageBuffer array;
+    array.data = values.data();
+    array.width = size;
+    array.height = size;
+    array.item_size = 4;
+    array.length = long(values.size() * 4);
+    array.data_type = ImageKernels::DataType_Float32;
+
+    printf("%dx%d float32, %d iterations, %s kernels\n", size, size, iterations, ImageKernels::instructionSetName());
+    printf("%-10s %-10s %12s %12s\n", "entries", "path", "convert ms", "+ draw ms");
+    for (int entry_count : {256, 4096})
+    {
+        // an opaque blue to yellow ramp.
+        std::vector<uint32_t> entries(entry_count);
+        for (int i = 0; i < entry_count; ++i)
+        {
+            const uint32_t level = uint32_t(255 * i / (entry_count - 1));
+            entries[i] = 0xFF000000u | level << 16 | level << 8 | (255 - level);
+        }
+
+        ImageKernels::ImageBuffer lookup_table;
+        lookup_table.data = entries.data();
+        lookup_table.width = entry_count;
+        lookup_table.height = 1;
+        lookup_table.item_size = 4;
+        lookup_table.length = entry_count * 4;
+        lookup_table.data_type = ImageKernels::DataType_UInt32;
+
+        const Timing indexed = TimeColormap(array, lookup_table, false, iterations);
+        const Timing direct = TimeColormap(array, lookup_table, true, iterations);
+        printf("%-10d %-10s %12.3f %12.3f\n", entry_count, "indexed8", indexed.convert_ms, indexed.draw_ms);
+        printf("%-10d %-10s %12.3f %12.3f\n", entry_count, "argb32", direct.convert_ms, direct.draw_ms);
+    }
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ Copyright (c) 2012-2024 Bruker, Inc.
+*/
+
+/*
+ Compare converting nested maps and lists between QVariant and Python objects directly (QVariantToPyObject
+ and PyObjectToQVariant) against converting through PythonValueVariant. The values are lists of maps shaped
+ like the arguments of item delegate and drag callbacks, with nested maps, lists and strings.
+
+ Usage: ConversionBenchmark python_home [item_count] [iterations]
+
+ python_home is the Python environment the launcher is started with.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <list>
+#include <string>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QStringList>
+#include <QtCore/QVariant>
+
+#include "Application.h"
+#include "PythonSupport.h"
+
+PythonValueVariant QVariantToPythonValueVariant(const QVariant &value);
+QVariant PythonValueVariantToQVariant(const PythonValueVariant &value_variant);
+PyObject *QVariantToPyObject(const QVariant &value);
+QVariant PyObjectToQVariant(PyObject *py_object);
+
+struct Timing
+{
+    double to_python_ms = 0.0;
+    double from_python_ms = 0.0;
+};
+
+static QVariant Items(int item_count)
+{
+    QVariantList items;
+    for (int i = 0; i < item_count; ++i)
+    {
+        QVariantMap rect;
+        rect["top"] = i * 20;
+        rect["left"] = 0;
+        rect["height"] = 20;
+        rect["width"] = 320;
+
+        QVariantMap style;
+        style["font"] = QString("normal 11px serif");
+        style["color"] = QString("#1E90FF");
+        style["opacity"] = 0.75;
+
+        QVariantMap item;
+        item["index"] = i;
+        item["row"] = i;
+        item["parent_row"] = -1;
+        item["display"] = QString("Data Item %1").arg(i);
+        item["selected"] = i % 3 == 0;
+        item["rect"] = rect;
+        item["style"] = style;
+        item["flags"] = QStringList() << "enabled" << "selectable" << "draggable";
+        item["mime_types"] = QVariantList() << QString("text/uri-list") << QString("text/plain");
+        items.append(item);
+    }
+    return items;
+}
+
+static Timing TimeConversion(const QVariant &value, bool direct, int iterations, QVariant &result)
+{
+    Timing timing;
+    QElapsedTimer timer;
+    for (int i = 0; i < iterations; ++i)
+    {
+        timer.start();
+        PyObject *py_object = direct ? QVariantToPyObject(value) : PythonValueVariantToPyObject(QVariantToPythonValueVariant(value));
+        timing.to_python_ms += timer.nsecsElapsed() / 1.0E6;
+        timer.start();
+        result = direct ? PyObjectToQVariant(py_object) : PythonValueVariantToQVariant(PyObjectToValueVariant(py_object));
+        timing.from_python_ms += timer.nsecsElapsed() / 1.0E6;
+        Py_DECREF(py_object);
+    }
+    timing.to_python_ms /= iterations;
+    timing.from_python_ms /= iterations;
+    return timing;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: ConversionBenchmark python_home [item_count] [iterations]\n");
+        return 1;
+    }
+
+    const int item_count = argc > 2 ? atoi(argv[2]) : 1000;
+    const int iterations = argc > 3 ? atoi(argv[3]) : 50;
+
+    FileSystem *fs = NewQFileSystem();
+    const std::string python_home = PythonSupport::ensurePython(fs, argv[1]);
+    PythonSupport::initInstance(fs, python_home, std::string());
+    if (!PythonSupport::instance()->isValid())
+    {
+        fprintf(stderr, "Unable to load Python from %s\n", argv[1]);
+        return 1;
+    }
+    PythonSupport::instance()->initialize(python_home, std::list<std::string>(), std::string());
+
+    {
+        Python_ThreadBlock thread_block;
+
+        const QVariant items = Items(item_count);
+
+        QVariant variant_result;
+        QVariant direct_result;
+        const Timing variant = TimeConversion(items, false, iterations, variant_result);
+        const Timing direct = TimeConversion(items, true, iterations, direct_result);
+
+        printf("%d items, %d iterations, results %s\n", item_count, iterations, variant_result == direct_result ? "match" : "differ");
+        printf("%-16s %14s %14s\n", "path", "to python ms", "from python ms");
+        printf("%-16s %14.3f %14.3f\n", "value variant", variant.to_python_ms, variant.from_python_ms);
+        printf("%-16s %14.3f %14.3f\n", "direct", direct.to_python_ms, direct.from_python_ms);
+    }
+
+    PythonSupport::instance()->deinitialize();
+    PythonSupport::deinitInstance();
+
+    return 0;
+}
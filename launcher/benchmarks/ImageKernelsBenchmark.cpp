@@ -0,0 +1,218 @@
+/*
+ Copyright (c) 2012-2024 Bruker, Inc.
+*/
+
+/*
+ Check that the vectorized image kernels give the same bytes as the scalar kernels for quantizeFloatToIndexed8,
+ arrayToIndexed8 and downsampledArrayToIndexed8, then time each instruction set. The values include NaN, infinities
+ and values at and beyond the limits; the limits include inverted, equal and infinite limits; the destination
+ sizes give runs of 2 and 4 source pixels and uneven runs. Returns non-zero if any result differs.
+
+ Usage: ImageKernelsBenchmark [size] [iterations]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <QtCore/QElapsedTimer>
+
+#include "ImageKernels.h"
+
+// an image in a byte vector, so that results can be compared exactly.
+class BufferImage : public ImageInterface
+{
+public:
+    virtual void create(unsigned int width, unsigned int height, ImageFormat image_type) override
+    {
+        m_width = width;
+        m_height = height;
+        m_bytes_per_line = width * (image_type == Format_Indexed8 ? 1 : 4);
+        pixels.assign(size_t(m_bytes_per_line) * height, 0);
+    }
+
+    virtual unsigned char *scanLine(unsigned int row) override { return pixels.data() + size_t(row) * m_bytes_per_line; }
+    virtual const unsigned char *scanLine(unsigned int row) const override { return pixels.data() + size_t(row) * m_bytes_per_line; }
+    virtual int width() const override { return m_width; }
+    virtual int height() const override { return m_height; }
+    virtual void setColorTable(const std::vector<unsigned int> & /*colorTable*/) override { }
+
+    std::vector<uint8_t> pixels;
+
+private:
+    int m_width = 0;
+    int m_height = 0;
+    int m_bytes_per_line = 0;
+};
+
+struct Limits
+{
+    float low;
+    float high;
+};
+
+static float DisplayScale(const Limits &limits)
+{
+    return limits.high != limits.low ? double(255) / (limits.high - limits.low) : 1;
+}
+
+// a smooth ramp over and beyond the limits with NaN, infinities and values at the limits mixed in.
+static std::vector<float> TestValues(long count)
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+    const float specials[] = { std::numeric_limits<float>::quiet_NaN(), infinity, -infinity, 0.0f, 1000.0f, -0.0f, 1.0e-40f, 3.0e38f, -3.0e38f };
+    std::vector<float> values(count);
+    for (long i = 0; i < count; ++i)
+    {
+        if (i % 13 == 5)
+            values[i] = specials[(i / 13) % (sizeof(specials) / sizeof(specials[0]))];
+        else
+            values[i] = 500.0f + 700.0f * sinf(i * 0.037f) * cosf(i * 0.0051f);
+    }
+    return values;
+}
+
+static const Limits test_limits[] = {
+    { 0.0f, 1000.0f },
+    { 1000.0f, 0.0f },  // inverted
+    { 250.0f, 250.0f },  // equal
+    { -1.0e-3f, 1.0e-3f },
+    { 0.0f, std::numeric_limits<float>::infinity() },
+    { -std::numeric_limits<float>::infinity(), 0.0f },
+};
+
+typedef std::vector<uint8_t> Result;
+
+// the results of each check, in order, for one instruction set.
+static std::vector<Result> RunChecks(int size)
+{
+    std::vector<Result> results;
+
+    // quantize over every count up to 70 and from unaligned addresses, to cover the vector remainders.
+    const std::vector<float> values = TestValues(4096 + 70);
+    for (const Limits &limits : test_limits)
+    {
+        const float m = DisplayScale(limits);
+        for (long count = 1; count <= 70; ++count)
+        {
+            for (long offset = 0; offset < 4; ++offset)
+            {
+                Result result(count);
+                ImageKernels::quantizeFloatToIndexed8(values.data() + offset, result.data(), count, limits.low, limits.high, m);
+                results.push_back(result);
+            }
+        }
+        Result result(4096);
+        ImageKernels::quantizeFloatToIndexed8(values.data(), result.data(), 4096, limits.low, limits.high, m);
+        results.push_back(result);
+    }
+
+    // arrays of float and uint16, full size and downsampled to runs of 2, 4 and uneven lengths in each direction.
+    const std::vector<float> image_values = TestValues(long(size) * size);
+    std::vector<uint16_t> image_values16(image_values.size());
+    for (size_t i = 0; i < image_values.size(); ++i)
+        image_values16[i] = uint16_t(i * 7919 % 65536);
+
+    const long dest_sizes[][2] = {
+        { size / 2, size / 2 },
+        { size / 4, size / 4 },
+        { size / 2, size / 4 },
+        { size * 10 / 33, size * 10 / 33 },
+        { size / 7, size / 3 },
+        { size / 4 + 1, size / 2 - 1 },
+        { 1, 1 },
+    };
+
+    for (const Limits &limits : test_limits)
+    {
+        for (int type = 0; type < 2; ++type)
+        {
+            const void *data = type == 0 ? static_cast<const void *>(image_values.data()) : static_cast<const void *>(image_values16.data());
+            const ImageKernels::DataType data_type = type == 0 ? ImageKernels::DataType_Float32 : ImageKernels::DataType_UInt16;
+            const Limits type_limits = type == 0 ? limits : Limits{ limits.low * 60.0f, limits.high * 60.0f };
+
+            BufferImage image;
+            ImageKernels::arrayToIndexed8(data, data_type, size, size, type_limits.low, type_limits.high, &image);
+            results.push_back(image.pixels);
+
+            for (const auto &dest_size : dest_sizes)
+            {
+                BufferImage downsampled;
+                ImageKernels::downsampledArrayToIndexed8(data, data_type, size, size, dest_size[0], dest_size[1], type_limits.low, type_limits.high, &downsampled);
+                results.push_back(downsampled.pixels);
+            }
+        }
+    }
+
+    return results;
+}
+
+struct Timing
+{
+    double quantize_ms = 0.0;
+    double downsample_ms = 0.0;
+};
+
+static Timing TimeKernels(int size, int iterations)
+{
+    const std::vector<float> values = TestValues(long(size) * size);
+    Result result(values.size());
+    Timing timing;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i)
+        ImageKernels::quantizeFloatToIndexed8(values.data(), result.data(), long(values.size()), 0.0f, 1000.0f, 0.255f);
+    timing.quantize_ms = timer.nsecsElapsed() / 1.0E6 / iterations;
+    timer.start();
+    for (int i = 0; i < iterations; ++i)
+    {
+        BufferImage image;
+        ImageKernels::downsampledArrayToIndexed8(values.data(), ImageKernels::DataType_Float32, size, size, size * 10 / 33, size * 10 / 33, 0.0f, 1000.0f, &image);
+    }
+    timing.downsample_ms = timer.nsecsElapsed() / 1.0E6 / iterations;
+    return timing;
+}
+
+int main(int argc, char **argv)
+{
+    const int size = argc > 1 ? atoi(argv[1]) : 2048;
+    const int iterations = argc > 2 ? atoi(argv[2]) : 20;
+
+    const std::vector<std::string> names = ImageKernels::instructionSetNames();
+
+    ImageKernels::setInstructionSet("scalar");
+    const std::vector<Result> expected = RunChecks(332);
+
+    int mismatches = 0;
+    for (const auto &name : names)
+    {
+        ImageKernels::setInstructionSet(name.c_str());
+        const std::vector<Result> actual = RunChecks(332);
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            if (actual[i] != expected[i])
+            {
+                printf("mismatch %s check %d\n", name.c_str(), int(i));
+                mismatches += 1;
+            }
+        }
+    }
+
+    printf("%d checks, %d mismatches\n", int(expected.size()), mismatches);
+
+    printf("%dx%d float32, %d iterations\n", size, size, iterations);
+    printf("%-10s %14s %14s\n", "kernels", "quantize ms", "downsample ms");
+    for (const auto &name : names)
+    {
+        ImageKernels::setInstructionSet(name.c_str());
+        const Timing timing = TimeKernels(size, iterations);
+        printf("%-10s %14.3f %14.3f\n", name.c_str(), timing.quantize_ms, timing.downsample_ms);
+    }
+
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+/*
+ Copyright (c) 2012-2024 Bruker, Inc.
+*/
+
+/*
+ Compare drawing a line plot with the packed polyline command (plin) against the path commands
+ (move, line, strk) it replaces, for one device pixel and wider lines.
+
+ Usage: PolylineBenchmark [point_count] [iterations]
+
+ The offscreen platform is used unless QT_QPA_PLATFORM is set.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include <QtCore/QElapsedTimer>
+#include <QtGui/QGuiApplication>
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+
+#include "DocumentWindow.h"
+
+// builds binary drawing commands the way the Python canvas encoder does.
+class CommandEncoder
+{
+public:
+    void command(const char *name)
+    {
+        quint32 word;
+        memcpy(&word, name, 4);
+        m_words.push_back(word);
+    }
+
+    void uint32(quint32 value) { m_words.push_back(value); }
+
+    void float32(float value)
+    {
+        quint32 word;
+        memcpy(&word, &value, 4);
+        m_words.push_back(word);
+    }
+
+    void string(const char *value)
+    {
+        const quint32 length = quint32(strlen(value));
+        m_words.push_back(length);
+        std::vector<quint32> words((length + 3) / 4, 0);
+        memcpy(words.data(), value, length);
+        m_words.insert(m_words.end(), words.begin(), words.end());
+    }
+
+    CommandsSharedPtr commands() const { return CommandsSharedPtr(new CommandBuffer(m_words.data(), m_words.size())); }
+
+private:
+    std::vector<quint32> m_words;
+};
+
+static CommandsSharedPtr PlotCommands(const std::vector<QPointF> &points, float line_width, bool packed)
+{
+    CommandEncoder encoder;
+    encoder.command("stst");
+    encoder.string("#1E90FF");
+    encoder.command("linw");
+    encoder.float32(line_width);
+    if (packed)
+    {
+        encoder.command("plin");
+        encoder.uint32(quint32(points.size()));
+        for (const auto &point : points)
+        {
+            encoder.float32(point.x());
+            encoder.float32(point.y());
+        }
+    }
+    else
+    {
+        encoder.command("bpth");
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            encoder.command(i == 0 ? "move" : "line");
+            encoder.float32(points[i].x());
+            encoder.float32(points[i].y());
+        }
+        encoder.command("strk");
+    }
+    return encoder.commands();
+}
+
+static double TimePaint(const CommandsSharedPtr &commands, const QSize &size, int iterations)
+{
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i)
+    {
+        image.fill(QColor(0,0,0,0));
+        QPainter painter(&image);
+        painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing);
+        PaintBinaryCommands(&painter, commands, ImageBufferMap(), RenderedTimeStamps(), 1.0);
+    }
+    return timer.nsecsElapsed() / 1.0E6 / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication app(argc, argv);
+
+    const int point_count = argc > 1 ? atoi(argv[1]) : 4000;
+    const int iterations = argc > 2 ? atoi(argv[2]) : 50;
+
+    const QSize size(2000, 600);
+
+    std::vector<QPointF> points;
+    for (int i = 0; i < point_count; ++i)
+    {
+        const double x = 10.0 + (size.width() - 20.0) * i / qMax(1, point_count - 1);
+        const double y = size.height() / 2.0 + size.height() / 3.0 * sin(i * 0.05) * cos(i * 0.0031);
+        points.push_back(QPointF(x, y));
+    }
+
+    printf("%d points, %d iterations, %dx%d\n", point_count, iterations, size.width(), size.height());
+    printf("%-12s %12s %12s %10s\n", "line width", "path ms", "plin ms", "speedup");
+    for (float line_width : {1.0f, 2.0f})
+    {
+        const double path_ms = TimePaint(PlotCommands(points, line_width, false), size, iterations);
+        const double packed_ms = TimePaint(PlotCommands(points, line_width, true), size, iterations);
+        printf("%-12.1f %12.3f %12.3f %9.2fx\n", line_width, path_ms, packed_ms, packed_ms > 0.0 ? path_ms / packed_ms : 0.0);
+    }
+
+    return 0;
+}